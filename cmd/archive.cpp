@@ -0,0 +1,760 @@
+#include <fmt/ranges.h>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <cppxx/multithreading/pool.h>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "archive.h"
+
+namespace fs = std::filesystem;
+
+
+uint32_t crc32(std::string_view data, uint32_t crc) {
+    static const auto table = []() {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (unsigned char c : data)
+        crc = table[(crc ^ c) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+bool is_archive(const std::string &path) {
+    const std::string extension = fs::path(path).extension().string();
+    return extension == ".tar" or extension == ".tgz" or extension == ".gz" or extension == ".tbz2" or extension == ".bz2"
+        or extension == ".xz" or extension == ".zip";
+}
+
+namespace {
+    // read-only mapping of a whole file
+    class Mapped {
+    public:
+        explicit Mapped(const std::string &path) {
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                throw cppxx::errorf("Cannot open {:?}: {}", path, std::strerror(errno));
+            cppxx::defer _ = [&]() { ::close(fd); };
+
+            struct stat st;
+            if (::fstat(fd, &st) < 0)
+                throw cppxx::errorf("Cannot stat {:?}: {}", path, std::strerror(errno));
+            if (st.st_size == 0)
+                return;
+
+            void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                throw cppxx::errorf("Cannot map {:?}: {}", path, std::strerror(errno));
+            data = {static_cast<const char *>(p), size_t(st.st_size)};
+        }
+
+        Mapped(const Mapped &) = delete;
+        ~Mapped() {
+            if (not data.empty())
+                ::munmap(const_cast<char *>(data.data()), data.size());
+        }
+
+        std::string_view data;
+    };
+
+    using Sink = std::function<void(std::string_view)>;
+
+    // canonical Huffman code of a deflate block, with a lookup table for the short codes
+    struct Huffman {
+        static constexpr int fast_bits = 10;
+
+        std::array<uint16_t, 16> count = {};
+        std::array<uint16_t, 288> symbol = {};
+        std::array<uint16_t, 1 << fast_bits> fast = {}; // symbol | length << 9, 0 for longer codes
+
+        void build(const uint8_t *lengths, int n) {
+            count.fill(0);
+            fast.fill(0);
+            for (int i = 0; i < n; ++i)
+                ++count[lengths[i]];
+            count[0] = 0;
+
+            int left = 1;
+            for (int len = 1; len < 16; ++len)
+                if (left = (left << 1) - count[len]; left < 0)
+                    throw std::runtime_error("Invalid deflate stream: over-subscribed code");
+
+            std::array<uint16_t, 16> offsets = {};
+            std::array<uint32_t, 16> next = {};
+            for (uint32_t len = 1, code = 0; len < 16; ++len) {
+                code = (code + count[len - 1]) << 1;
+                next[len] = code;
+                if (len < 15)
+                    offsets[len + 1] = offsets[len] + count[len];
+            }
+
+            for (int sym = 0; sym < n; ++sym) {
+                const int len = lengths[sym];
+                if (len == 0)
+                    continue;
+                symbol[offsets[len]++] = sym;
+
+                // the bit reader is LSB first, while codes are stored MSB first
+                const uint32_t code = next[len]++;
+                if (len > fast_bits)
+                    continue;
+                uint32_t reversed = 0;
+                for (int k = 0; k < len; ++k)
+                    reversed = (reversed << 1) | ((code >> k) & 1);
+                for (uint32_t i = reversed; i < fast.size(); i += 1u << len)
+                    fast[i] = sym | len << 9;
+            }
+        }
+    };
+
+    // Raw deflate (RFC 1951) decoder, emits the output in chunks while keeping the 32K window
+    class Inflater {
+    public:
+        Inflater(std::string_view in, Sink sink)
+            : in(in)
+            , sink(std::move(sink)) {
+            out.reserve(window + chunk + 258);
+        }
+
+        // returns the number of input bytes consumed
+        size_t run() {
+            for (bool last = false; not last;) {
+                last = bits(1);
+                switch (bits(2)) {
+                case 0: stored(); break;
+                case 1: codes(fixed().first, fixed().second); break;
+                case 2: dynamic(); break;
+                default: throw std::runtime_error("Invalid deflate stream: bad block type");
+                }
+            }
+            flush();
+            return pos - cnt / 8;
+        }
+
+        uint64_t total = 0;
+        uint32_t crc = 0;
+
+    private:
+        static constexpr size_t window = 32768;
+        static constexpr size_t chunk = 1 << 20;
+
+        void refill() {
+            while (cnt <= 56 and pos < in.size()) {
+                buf |= uint64_t(uint8_t(in[pos++])) << cnt;
+                cnt += 8;
+            }
+        }
+
+        uint32_t bits(int n) {
+            if (cnt < n)
+                refill();
+            if (cnt < n)
+                throw std::runtime_error("Invalid deflate stream: truncated");
+            const uint32_t v = buf & ((uint64_t(1) << n) - 1);
+            buf >>= n;
+            cnt -= n;
+            return v;
+        }
+
+        int decode(const Huffman &h) {
+            if (cnt < 15)
+                refill();
+
+            if (uint16_t e = h.fast[buf & ((1u << Huffman::fast_bits) - 1)]; e != 0) {
+                const int len = e >> 9;
+                if (len > cnt)
+                    throw std::runtime_error("Invalid deflate stream: truncated");
+                buf >>= len;
+                cnt -= len;
+                return e & 511;
+            }
+
+            for (int len = 1, code = 0, first = 0, index = 0; len < 16 and len <= cnt; ++len) {
+                code |= (buf >> (len - 1)) & 1;
+                if (code - h.count[len] < first) {
+                    buf >>= len;
+                    cnt -= len;
+                    return h.symbol[index + (code - first)];
+                }
+                index += h.count[len];
+                first = (first + h.count[len]) << 1;
+                code <<= 1;
+            }
+            throw std::runtime_error("Invalid deflate stream: bad code");
+        }
+
+        void flush() {
+            const std::string_view pending = std::string_view(out).substr(emitted);
+            sink(pending);
+            crc = crc32(pending, crc);
+            total += pending.size();
+            if (out.size() > window)
+                out.erase(0, out.size() - window);
+            emitted = out.size();
+        }
+
+        void stored() {
+            // drop to the byte boundary and give the whole bytes in the bit buffer back
+            pos -= cnt / 8;
+            buf = 0;
+            cnt = 0;
+            if (pos + 4 > in.size())
+                throw std::runtime_error("Invalid deflate stream: truncated");
+
+            const size_t len = uint8_t(in[pos]) | uint8_t(in[pos + 1]) << 8;
+            const size_t nlen = uint8_t(in[pos + 2]) | uint8_t(in[pos + 3]) << 8;
+            if (len != (~nlen & 0xffff))
+                throw std::runtime_error("Invalid deflate stream: bad stored block length");
+            if (pos += 4; pos + len > in.size())
+                throw std::runtime_error("Invalid deflate stream: truncated");
+
+            out.append(in.substr(pos, len));
+            pos += len;
+            if (out.size() - emitted >= chunk)
+                flush();
+        }
+
+        void codes(const Huffman &lencode, const Huffman &distcode) {
+            static constexpr uint16_t len_base[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+            static constexpr uint8_t len_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+            static constexpr uint16_t dist_base[] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                                     193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+            static constexpr uint8_t dist_extra[] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                                     6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+            for (int sym; (sym = decode(lencode)) != 256;) {
+                if (sym < 256) {
+                    out.push_back(char(sym));
+                } else {
+                    if (sym -= 257; sym >= 29)
+                        throw std::runtime_error("Invalid deflate stream: bad length symbol");
+                    const size_t len = len_base[sym] + bits(len_extra[sym]);
+
+                    const int dsym = decode(distcode);
+                    if (dsym >= 30)
+                        throw std::runtime_error("Invalid deflate stream: bad distance symbol");
+                    const size_t dist = dist_base[dsym] + bits(dist_extra[dsym]);
+                    if (dist > out.size())
+                        throw std::runtime_error("Invalid deflate stream: distance too far back");
+
+                    // byte by byte when the source overlaps with what is being written
+                    const size_t from = out.size() - dist, to = out.size();
+                    out.resize(to + len);
+                    if (dist >= len)
+                        std::memcpy(out.data() + to, out.data() + from, len);
+                    else
+                        for (size_t i = 0; i < len; ++i)
+                            out[to + i] = out[from + i];
+                }
+
+                if (out.size() - emitted >= chunk)
+                    flush();
+            }
+        }
+
+        static const std::pair<Huffman, Huffman> &fixed() {
+            static const auto codes = []() {
+                std::array<uint8_t, 288> lengths;
+                std::fill_n(lengths.begin(), 144, 8);
+                std::fill_n(lengths.begin() + 144, 112, 9);
+                std::fill_n(lengths.begin() + 256, 24, 7);
+                std::fill_n(lengths.begin() + 280, 8, 8);
+                std::pair<Huffman, Huffman> res;
+                res.first.build(lengths.data(), 288);
+                lengths.fill(5);
+                res.second.build(lengths.data(), 30);
+                return res;
+            }();
+            return codes;
+        }
+
+        void dynamic() {
+            static constexpr uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+            const int nlen = bits(5) + 257, ndist = bits(5) + 1, ncode = bits(4) + 4;
+            if (nlen > 286 or ndist > 30)
+                throw std::runtime_error("Invalid deflate stream: bad counts");
+
+            std::array<uint8_t, 320> lengths = {};
+            for (int i = 0; i < ncode; ++i)
+                lengths[order[i]] = bits(3);
+
+            Huffman lencode, distcode;
+            lencode.build(lengths.data(), 19);
+
+            for (int index = 0; index < nlen + ndist;) {
+                int sym = decode(lencode);
+                if (sym < 16) {
+                    lengths[index++] = sym;
+                    continue;
+                }
+
+                uint8_t len = 0;
+                int repeat = 0;
+                if (sym == 16) {
+                    if (index == 0)
+                        throw std::runtime_error("Invalid deflate stream: repeat without a length");
+                    len = lengths[index - 1];
+                    repeat = 3 + bits(2);
+                } else if (sym == 17) {
+                    repeat = 3 + bits(3);
+                } else {
+                    repeat = 11 + bits(7);
+                }
+                if (index + repeat > nlen + ndist)
+                    throw std::runtime_error("Invalid deflate stream: too many lengths");
+                while (repeat--)
+                    lengths[index++] = len;
+            }
+
+            if (lengths[256] == 0)
+                throw std::runtime_error("Invalid deflate stream: missing end of block code");
+
+            lencode.build(lengths.data(), nlen);
+            distcode.build(lengths.data() + nlen, ndist);
+            codes(lencode, distcode);
+        }
+
+        std::string_view in;
+        Sink sink;
+        size_t pos = 0;
+        uint64_t buf = 0;
+        int cnt = 0;
+        std::string out;
+        size_t emitted = 0;
+    };
+
+    uint32_t le32(std::string_view in, size_t p) {
+        if (p + 4 > in.size())
+            throw std::runtime_error("Unexpected end of archive");
+        return uint8_t(in[p]) | uint8_t(in[p + 1]) << 8 | uint8_t(in[p + 2]) << 16 | uint32_t(uint8_t(in[p + 3])) << 24;
+    }
+
+    uint16_t le16(std::string_view in, size_t p) {
+        if (p + 2 > in.size())
+            throw std::runtime_error("Unexpected end of archive");
+        return uint8_t(in[p]) | uint8_t(in[p + 1]) << 8;
+    }
+
+    // gzip (RFC 1952), possibly with multiple members
+    void gunzip(std::string_view in, const Sink &sink) {
+        for (size_t pos = 0; pos < in.size() and in[pos] != '\0';) {
+            if (pos + 10 > in.size() or uint8_t(in[pos]) != 0x1f or uint8_t(in[pos + 1]) != 0x8b or in[pos + 2] != 8)
+                throw std::runtime_error("Invalid gzip header");
+
+            const uint8_t flags = in[pos + 3];
+            size_t p = pos + 10;
+            if (flags & 4)
+                p += 2 + le16(in, p);
+            for (int flag : {8, 16}) // zero terminated name and comment
+                if (flags & flag)
+                    p = std::min(in.find('\0', p), in.size()) + 1;
+            if (flags & 2)
+                p += 2;
+            if (p > in.size())
+                throw std::runtime_error("Invalid gzip header");
+
+            Inflater inflater(in.substr(p), sink);
+            p += inflater.run();
+            if (le32(in, p) != inflater.crc or le32(in, p + 4) != uint32_t(inflater.total))
+                throw std::runtime_error("Corrupted gzip stream: checksum mismatch");
+            pos = p + 8;
+        }
+    }
+
+    // Writes the entries of an archive below `dir`, file contents are produced and written on a worker pool
+    class Extractor {
+    public:
+        explicit Extractor(fs::path dir)
+            : dir(std::move(dir))
+            , workers(std::max<int>(std::thread::hardware_concurrency(), 1))
+            , pool(workers) {}
+
+        void directory(const std::string &path) {
+            if (auto p = target(path))
+                fs::create_directories(*p);
+        }
+
+        void file(const std::string &path, uint32_t mode, std::function<std::string()> content) {
+            auto p = target(path);
+            if (not p)
+                return;
+
+            fs::create_directories(p->parent_path());
+            std::error_code ec;
+            fs::remove(*p, ec);
+
+            pool << [p = std::move(*p), mode, content = std::move(content)]() -> std::expected<void, std::runtime_error> {
+                try {
+                    const std::string data = content();
+                    std::ofstream os(p, std::ios::binary | std::ios::trunc);
+                    if (not os.write(data.data(), data.size()))
+                        return cppxx::unexpected_errorf("Failed to write {:?}", p.string());
+                    os.close();
+
+                    std::error_code ec;
+                    if (mode & 0777)
+                        fs::permissions(p, static_cast<fs::perms>(mode & 0777), ec);
+                    return {};
+                } catch (std::runtime_error &e) {
+                    return cppxx::unexpected_errorf("Failed to extract {:?}: {}", p.string(), e.what());
+                }
+            };
+
+            // bound the decoded contents held in memory
+            if (++pending >= size_t(workers) * 4)
+                collect(1);
+        }
+
+        void symlink(const std::string &path, const std::string &link) {
+            auto p = target(path);
+            if (not p)
+                return;
+
+            fs::create_directories(p->parent_path());
+            std::error_code ec;
+            fs::remove(*p, ec);
+            fs::create_symlink(link, *p);
+            symlinks.insert(p->string());
+        }
+
+        void hardlink(const std::string &path, const std::string &link) {
+            auto p = target(path), from = target(link);
+            if (p and from)
+                hardlinks.emplace_back(*p, *from);
+        }
+
+        // wait for every write, then create the hard links whose targets are complete by now
+        void finish() {
+            collect(pending);
+            if (err)
+                throw std::move(*err);
+
+            for (const auto &[p, from] : hardlinks) {
+                fs::create_directories(p.parent_path());
+                std::error_code ec;
+                fs::remove(p, ec);
+                if (fs::create_hard_link(from, p, ec); ec)
+                    fs::copy_file(from, p);
+            }
+        }
+
+    private:
+        // an entry must stay below `dir` and must not be written through a symlink of the same archive
+        std::optional<fs::path> target(const std::string &path) {
+            const fs::path relative = fs::path(path).lexically_normal();
+            if (relative.empty() or relative == ".")
+                return std::nullopt;
+            if (relative.is_absolute() or *relative.begin() == "..")
+                throw cppxx::errorf("Refusing to extract {:?} outside of the destination", path);
+
+            for (fs::path parent = relative.parent_path(); not parent.empty(); parent = parent.parent_path())
+                if (symlinks.contains((dir / parent).string()))
+                    throw cppxx::errorf("Refusing to extract {:?} through a symlink", path);
+
+            return dir / relative;
+        }
+
+        void collect(size_t n) {
+            for (; n > 0; --n, --pending)
+                pool >> [&](std::expected<void, std::runtime_error> &&res) {
+                    if (not res and not err)
+                        err.emplace(std::move(res.error()));
+                };
+        }
+
+        fs::path dir;
+        int workers;
+        size_t pending = 0;
+        std::optional<std::runtime_error> err = std::nullopt;
+        std::unordered_set<std::string> symlinks;
+        std::vector<std::pair<fs::path, fs::path>> hardlinks;
+        cppxx::multithreading::Pool<std::expected<void, std::runtime_error>> pool;
+    };
+
+    // Push parser for ustar/GNU/pax tar streams, so it can sit behind any decompressor
+    class TarReader {
+    public:
+        explicit TarReader(Extractor &out)
+            : out(out) {}
+
+        void feed(std::string_view data) {
+            while (not data.empty() and not ended) {
+                if (remaining > 0) {
+                    const size_t n = std::min<uint64_t>(remaining, data.size());
+                    entry.append(data.substr(0, n));
+                    data.remove_prefix(n);
+                    if (remaining -= n; remaining == 0)
+                        complete();
+                } else if (padding > 0) {
+                    const size_t n = std::min<uint64_t>(padding, data.size());
+                    data.remove_prefix(n);
+                    padding -= n;
+                } else {
+                    const size_t n = std::min(512 - header.size(), data.size());
+                    header.append(data.substr(0, n));
+                    data.remove_prefix(n);
+                    if (header.size() == 512)
+                        parse_header();
+                }
+            }
+        }
+
+        void finish() {
+            if (remaining > 0 or not header.empty())
+                throw std::runtime_error("Unexpected end of tar archive");
+        }
+
+    private:
+        static std::string field(std::string_view h, size_t offset, size_t size) {
+            auto f = h.substr(offset, size);
+            return std::string(f.substr(0, f.find('\0')));
+        }
+
+        static uint64_t number(std::string_view h, size_t offset, size_t size) {
+            auto f = h.substr(offset, size);
+            uint64_t value = 0;
+
+            // GNU base-256 for values that do not fit in octal
+            if (uint8_t(f[0]) & 0x80) {
+                for (size_t i = 0; i < f.size(); ++i)
+                    value = value << 8 | uint8_t(i == 0 ? f[i] & 0x7f : f[i]);
+                return value;
+            }
+
+            for (char c : f)
+                if (c >= '0' and c <= '7')
+                    value = value << 3 | (c - '0');
+                else if (c != ' ' and value != 0)
+                    break;
+            return value;
+        }
+
+        void parse_header() {
+            const std::string_view h = header;
+            if (h.find_first_not_of('\0') == std::string_view::npos) {
+                ended = true;
+                header.clear();
+                return;
+            }
+
+            uint64_t sum = 0;
+            for (size_t i = 0; i < 512; ++i)
+                sum += i >= 148 and i < 156 ? ' ' : uint8_t(h[i]);
+            if (sum != number(h, 148, 8))
+                throw std::runtime_error("Invalid tar header: checksum mismatch");
+
+            path = field(h, 0, 100);
+            if (h.substr(257, 5) == "ustar")
+                if (auto prefix = field(h, 345, 155); not prefix.empty())
+                    path = prefix + '/' + path;
+            link = field(h, 157, 100);
+            mode = number(h, 100, 8);
+            type = h[156];
+            remaining = number(h, 124, 12);
+            padding = (512 - remaining % 512) % 512;
+            entry.clear();
+            header.clear();
+
+            if (remaining == 0)
+                complete();
+        }
+
+        void complete() {
+            switch (type) {
+            case 'L': long_path = entry.c_str(); return;
+            case 'K': long_link = entry.c_str(); return;
+            case 'x': parse_pax(); return;
+            case 'g': return;
+            default: break;
+            }
+
+            if (long_path)
+                path = *std::exchange(long_path, std::nullopt);
+            if (long_link)
+                link = *std::exchange(long_link, std::nullopt);
+
+            switch (type) {
+            case '0':
+            case '\0':
+            case '7': out.file(path, mode, [data = std::move(entry)]() mutable { return std::move(data); }); break;
+            case '5': out.directory(path); break;
+            case '2': out.symlink(path, link); break;
+            case '1': out.hardlink(path, link); break;
+            default: break; // devices and fifos are not needed for sources
+            }
+            entry.clear();
+        }
+
+        // records of "<length> <key>=<value>\n"
+        void parse_pax() {
+            for (std::string_view records = entry; not records.empty();) {
+                const size_t space = records.find(' ');
+                const size_t len = std::strtoull(std::string(records.substr(0, space)).c_str(), nullptr, 10);
+                if (space == std::string_view::npos or len <= space + 1 or len > records.size())
+                    throw std::runtime_error("Invalid pax header");
+
+                const auto record = records.substr(space + 1, len - space - 2);
+                const auto eq = record.find('=');
+                if (record.substr(0, eq) == "path")
+                    long_path = std::string(record.substr(eq + 1));
+                else if (record.substr(0, eq) == "linkpath")
+                    long_link = std::string(record.substr(eq + 1));
+                records.remove_prefix(len);
+            }
+        }
+
+        Extractor &out;
+        std::string header, entry, path, link;
+        std::optional<std::string> long_path, long_link;
+        uint32_t mode = 0;
+        char type = '0';
+        uint64_t remaining = 0, padding = 0;
+        bool ended = false;
+    };
+
+    // the central directory is authoritative, entries are inflated and written in parallel
+    void unzip(std::string_view in, Extractor &out) {
+        size_t eocd = std::string_view::npos;
+        for (size_t p = in.size() >= 22 ? in.size() - 22 : 0; in.size() >= 22 and in.size() - p <= 65535 + 22; --p) {
+            if (le32(in, p) == 0x06054b50) {
+                eocd = p;
+                break;
+            }
+            if (p == 0)
+                break;
+        }
+        if (eocd == std::string_view::npos)
+            throw std::runtime_error("Invalid zip archive: missing end of central directory");
+
+        const size_t count = le16(in, eocd + 10);
+        size_t p = le32(in, eocd + 16);
+        if (count == 0xffff or p == 0xffffffff)
+            throw std::runtime_error("Zip64 archives are not supported");
+
+        for (size_t i = 0; i < count; ++i) {
+            if (le32(in, p) != 0x02014b50)
+                throw std::runtime_error("Invalid zip archive: bad central directory entry");
+
+            const bool from_unix = le16(in, p + 4) >> 8 == 3;
+            const uint16_t method = le16(in, p + 10);
+            const uint32_t crc = le32(in, p + 16), csize = le32(in, p + 20), usize = le32(in, p + 24);
+            const size_t nlen = le16(in, p + 28), elen = le16(in, p + 30), clen = le16(in, p + 32);
+            const uint32_t mode = from_unix ? le32(in, p + 38) >> 16 : 0644;
+            const size_t local = le32(in, p + 42);
+            const std::string name(in.substr(p + 46, nlen));
+            p += 46 + nlen + elen + clen;
+
+            if (csize == 0xffffffff or usize == 0xffffffff or local == 0xffffffff)
+                throw std::runtime_error("Zip64 archives are not supported");
+            if (le32(in, local) != 0x04034b50)
+                throw cppxx::errorf("Invalid zip archive: bad local header of {:?}", name);
+
+            const size_t offset = local + 30 + le16(in, local + 26) + le16(in, local + 28);
+            if (offset + csize > in.size())
+                throw std::runtime_error("Unexpected end of archive");
+
+            auto content = [data = in.substr(offset, csize), method, crc, usize, name]() {
+                std::string res;
+                if (method == 0)
+                    res = data;
+                else if (method == 8)
+                    Inflater(data, [&](std::string_view chunk) { res.append(chunk); }).run();
+                else
+                    throw cppxx::errorf("Unsupported zip compression method {} of {:?}", method, name);
+
+                if (res.size() != usize or crc32(res) != crc)
+                    throw cppxx::errorf("Corrupted zip entry {:?}: checksum mismatch", name);
+                return res;
+            };
+
+            if (name.ends_with('/'))
+                out.directory(name);
+            else if (S_ISLNK(mode))
+                out.symlink(name, content());
+            else
+                out.file(name, mode & 0777, std::move(content));
+        }
+    }
+
+    // xz and bzip2 are left to their command line tools, streamed into the tar reader
+    void decompress_with(const std::string &tool, const std::string &archive, TarReader &tar) {
+        const std::string cmd = fmt::format("{} -dc '{}'", tool, archive);
+        FILE *pipe = ::popen(cmd.c_str(), "r");
+        if (not pipe)
+            throw cppxx::errorf("Failed to run {:?}", cmd);
+
+        std::optional<std::runtime_error> err;
+        try {
+            std::array<char, 1 << 16> buffer;
+            for (size_t n; (n = std::fread(buffer.data(), 1, buffer.size(), pipe)) > 0;)
+                tar.feed({buffer.data(), n});
+        } catch (std::runtime_error &e) {
+            err.emplace(std::move(e));
+        }
+
+        const int status = ::pclose(pipe);
+        if (err)
+            throw std::move(*err);
+        if (status != 0)
+            throw cppxx::errorf("{:?} exited with return code {}", cmd, WEXITSTATUS(status));
+    }
+} // namespace
+
+std::expected<void, std::runtime_error> extract_archive(const std::string &archive, const std::string &dir) {
+    try {
+        const Mapped mapped(archive);
+        const std::string_view data = mapped.data;
+        Extractor out(dir);
+        fs::create_directories(dir);
+
+        // the magic bytes are more reliable than the extension
+        if (data.starts_with("PK\x03\x04") or data.starts_with("PK\x05\x06")) {
+            unzip(data, out);
+        } else if (data.starts_with("\x1f\x8b")) {
+            TarReader tar(out);
+            gunzip(data, [&](std::string_view chunk) { tar.feed(chunk); });
+            tar.finish();
+        } else if (data.starts_with("\xfd" "7zXZ")) {
+            TarReader tar(out);
+            decompress_with("xz", archive, tar);
+            tar.finish();
+        } else if (data.starts_with("BZh")) {
+            TarReader tar(out);
+            decompress_with("bzip2", archive, tar);
+            tar.finish();
+        } else {
+            TarReader tar(out);
+            tar.feed(data);
+            tar.finish();
+        }
+
+        out.finish();
+        return {};
+    } catch (std::exception &e) {
+        return cppxx::unexpected_errorf("Failed to extract {:?}: {}", archive, e.what());
+    }
+}
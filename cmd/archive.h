@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+// Extract a .tar, .tar.gz/.tgz, .tar.bz2/.tbz2, .tar.xz or .zip archive into `dir`, in a single pass and in process.
+// Tar and gzip (and the deflate entries of zip) are decoded here, xz and bzip2 are streamed from `xz -dc`/`bzip2 -dc`.
+// File contents are written on a worker pool while the archive is still being decoded
+std::expected<void, std::runtime_error> extract_archive(const std::string &archive, const std::string &dir);
+
+bool is_archive(const std::string &path);
+
+// CRC-32 (ISO-HDLC) as used by gzip and zip, continued from `crc`
+uint32_t crc32(std::string_view data, uint32_t crc = 0);
@@ -2,71 +2,925 @@
 #include <spdlog/spdlog.h>
 #include <cppxx/error.h>
 #include <cppxx/iterator.h>
-#include <cppxx/multithreading/channel.h>
+#include <cppxx/defer.h>
+#include <sha256.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
 #include "workspace.h"
 #include "options.h"
 #include "system.h"
+#include "dependency_graph.h"
+#include "object_cache.h"
+#include "build_log.h"
+#include "jobserver.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "watch.h"
+#include "worker.h"
+#include "modules.h"
 
 namespace fs = std::filesystem;
 
 
+// Look the object up by the hash of its preprocessed source and command first, compile only on a miss.
+// A module unit is keyed by the BMIs it imports as well, and its own BMI is cached along with the object
+static std::expected<void, std::runtime_error> compile(const CompileCommand &cc,
+                                                       const ModuleUnit *unit,
+                                                       DependencyGraph &graph,
+                                                       ObjectCache &objects,
+                                                       Workers &workers,
+                                                       std::stop_token stop) {
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const std::string object = cc.get_abs_path();
+    const std::string preprocessed = object + ".i";
+
+    try {
+        fs::create_directories(fs::path(object).parent_path());
+    } catch (std::runtime_error &e) {
+        return cppxx::unexpected_errorf("Failed to compile {:?}: {}", cc.file, e.what());
+    }
+
+    cppxx::defer _ = [&]() {
+        std::error_code ec;
+        fs::remove(preprocessed, ec);
+    };
+
+    // a failing preprocessor is reported by the actual compile below
+    std::string key;
+    const auto imports = unit ? unit->imports_key() : std::optional<std::string>("");
+    if (Trace::Scope _("preprocess", "compile");
+        imports and spawn(split_args(cc.get_preprocess_command(preprocessed)), cc.directory, true, stop)) {
+        std::ifstream is(preprocessed, std::ios::binary);
+        std::stringstream ss;
+        ss << cc.base_command() << '\n' << *imports << is.rdbuf();
+        key = SHA256::hashString(ss.str());
+    }
+
+    const bool has_bmi = unit and not unit->bmi.empty();
+    const std::string bmi_key = has_bmi ? SHA256::hashString(key + "\nbmi") : "";
+    if (not key.empty() and objects.fetch(key, object) and (not has_bmi or objects.fetch(bmi_key, unit->bmi))) {
+        spdlog::debug("{:?} is fetched from the object cache", cc.file);
+        return graph.update(cc, elapsed());
+    }
+
+    auto store = [&]() {
+        if (not key.empty()) {
+            auto res = objects.store(key, object);
+            if (res and has_bmi)
+                res = objects.store(bmi_key, unit->bmi);
+            if (not res)
+                spdlog::warn("{}", res.error().what());
+        }
+
+        return graph.update(cc, elapsed());
+    };
+
+    // the preprocessed source is all a worker needs, the depfile has been written while preprocessing.
+    // Module units need BMIs a worker does not have
+    if (not key.empty() and not unit)
+        if (auto remote = workers.compile(cc, preprocessed, object, stop))
+            return std::move(*remote).and_then(store);
+
+    const auto compile_start = Trace::Clock::now();
+    return spawn(split_args(cc.command), cc.directory, false, stop).and_then([&]() {
+        Trace::merge_time_trace(fs::path(object).replace_extension(".json").string(), compile_start);
+        return store();
+    });
+}
+
+// Precompiled headers are neither cached nor sent to workers, they are only valid for the compiler that made them
+static std::expected<void, std::runtime_error> precompile(const CompileCommand &cc, DependencyGraph &graph, std::stop_token stop) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    fs::create_directories(fs::path(cc.get_abs_path()).parent_path(), ec);
+
+    return spawn(split_args(cc.command), cc.directory, false, stop).and_then([&]() {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        return graph.update(cc, elapsed.count());
+    });
+}
+
+
+// Concurrent builds in one process (the daemon serving several clients) run an identical step only once,
+// the later ones wait for the result of the first instead of writing the same output at the same time
+template <typename T>
+static std::expected<T, std::runtime_error> once(const std::string &key, const std::function<std::expected<T, std::runtime_error>()> &fn) {
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::shared_future<std::expected<T, std::runtime_error>>> running;
+
+    std::promise<std::expected<T, std::runtime_error>> promise;
+    {
+        std::unique_lock lock(mutex);
+        if (auto it = running.find(key); it != running.end()) {
+            auto result = it->second;
+            lock.unlock();
+            return result.get();
+        }
+        running.emplace(key, promise.get_future().share());
+    }
+
+    auto result = fn();
+    promise.set_value(result);
+
+    std::lock_guard lock(mutex);
+    running.erase(key);
+    return result;
+}
+
+
+// Identity of the link inputs taken from the build log, so that checking them does not stat every object
+static std::optional<uint64_t> link_inputs_hash(const BuildLog &log, const std::vector<std::string> &objects) {
+    std::string combined;
+    for (const auto &object : objects) {
+        const auto entry = log.find(object);
+        if (not entry)
+            return std::nullopt;
+        combined += fmt::format("{}\n{:x}\n{:x}\n", object, entry->command_hash, entry->inputs_hash);
+    }
+    return BuildLog::hash(combined);
+}
+
+// Run `cmd` to produce `output` from `inputs`, unless the build log says the output is already up to date.
+// `extra` arguments do not change the output, e.g. the number of jobs, and are not part of the recorded command.
+// Returns whether the command actually ran.
+static std::expected<bool, std::runtime_error> produce(BuildLog &log,
+                                                       const std::string &cmd,
+                                                       const std::string &output,
+                                                       const std::vector<std::string> &inputs,
+                                                       bool changed,
+                                                       const std::string &action,
+                                                       std::stop_token stop,
+                                                       const std::string &extra = "") {
+    const auto start = std::chrono::steady_clock::now();
+
+    // rerun only if the command, any input, or the output itself changed since the last time
+    const auto inputs_hash = link_inputs_hash(log, inputs);
+    if (const auto entry = log.find(output); not changed and entry and inputs_hash
+        and entry->command_hash == BuildLog::hash(cmd) and entry->inputs_hash == *inputs_hash) {
+        std::error_code ec; // to avoid exceptions
+        if (auto time = fs::last_write_time(output, ec); not ec and time.time_since_epoch().count() == entry->mtime)
+            return false;
+    }
+
+    return once<bool>(output + '\n' + cmd, [&]() -> std::expected<bool, std::runtime_error> {
+        spdlog::info("{} {}", action, output);
+        try {
+            fs::create_directories(fs::path(output).parent_path());
+            fs::remove(output); // `ar` would otherwise keep stale members around
+        } catch (std::runtime_error &e) {
+            return cppxx::unexpected_errorf("Failed to build {:?}: {}", output, e.what());
+        }
+
+        if (auto res = spawn(split_args(extra.empty() ? cmd : cmd + ' ' + extra), "", false, stop); not res)
+            return cppxx::unexpected_errorf("Failed to build {:?}, {}", output, res.error().what());
+
+        std::error_code ec;
+        if (auto time = fs::last_write_time(output, ec); not ec and inputs_hash) {
+            const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            log.record(output, BuildLog::hash(cmd), time.time_since_epoch().count(), *inputs_hash, duration.count(), inputs);
+        }
+
+        return true;
+    });
+}
+
+// A tool of the toolchain of `driver`, e.g. llvm-ar-18 for clang++-18 or gcc-ar-13 for g++-13. Empty if unknown
+static std::string tool_of(const std::string &driver, std::string_view gnu, std::string_view llvm) {
+    const fs::path path = driver;
+    std::string name = path.filename().string();
+    const std::pair<std::string_view, std::string_view> tools[] = {
+        {"clang++", llvm}, {"clang", llvm}, {"g++", gnu}, {"gcc", gnu}, {"c++", gnu},
+    };
+    for (auto [compiler, tool] : tools)
+        if (size_t pos = name.find(compiler); pos != std::string::npos and not tool.empty())
+            return (path.parent_path() / name.replace(pos, compiler.size(), tool)).string();
+    return "";
+}
+
+// LTO objects carry no machine code, so the archive index of their symbols has to come from the compiler plugin
+static std::string archiver_of(const Linking &l) {
+    if (l.lto.empty())
+        return "ar";
+    const std::string archiver = tool_of(l.driver, "gcc-ar", "llvm-ar");
+    return archiver.empty() ? "ar" : archiver;
+}
+
+// The code generation of LTO runs as many jobs as the build may, GCC takes them from the jobserver if there is one
+static std::string parallel_lto(const Linking &l, int jobs) {
+    if (l.lto.empty())
+        return "";
+    if (not l.clang()) {
+        const char *makeflags = std::getenv("MAKEFLAGS");
+        return makeflags and std::string_view(makeflags).contains("jobserver") ? "-flto=jobserver" : fmt::format("-flto={}", jobs);
+    }
+    if (l.lto != "thin")
+        return "";
+    return l.linker == "lld" ? fmt::format("-Wl,--thinlto-jobs={}", jobs) : fmt::format("-Wl,-plugin-opt,jobs={}", jobs);
+}
+
+static std::expected<bool, std::runtime_error> archive(BuildLog &log, const Archive &a, bool changed, int jobs, std::stop_token stop) {
+    const auto cmd = a.dynamic ? fmt::format("{} -shared {} {} -o {}", a.linking.driver, fmt::join(a.objects, " "),
+                                             fmt::join(a.link_flags, " "), a.output)
+                               : fmt::format("{} rcs {} {}", archiver_of(a.linking), a.output, fmt::join(a.objects, " "));
+
+    return produce(log, cmd, a.output, a.objects, changed, a.dynamic ? "linking" : "archiving", stop,
+                   a.dynamic ? parallel_lto(a.linking, jobs) : "");
+}
+
+static std::expected<bool, std::runtime_error> link(BuildLog &log,
+                                                    const std::vector<std::string> &inputs,
+                                                    const std::unordered_set<std::string> &link_flags,
+                                                    const Linking &linking,
+                                                    const std::string &out,
+                                                    bool changed,
+                                                    int jobs,
+                                                    std::stop_token stop) {
+    const auto cmd = fmt::format("{} {} {} -o {}", linking.driver, fmt::join(inputs, " "), fmt::join(link_flags, " "), out);
+    return produce(log, cmd, fs::absolute(out).string(), inputs, changed, "building", stop, parallel_lto(linking, jobs));
+}
+
 std::expected<void, std::runtime_error> build(CompileCommands &&ccs, int jobs, const std::string &out) {
-    auto filtered = ccs.ccs | cppxx::filter([](const CompileCommand &cc) {
-                        std::error_code ec; // to avoid exceptions
-                        auto file_time = fs::last_write_time(cc.file, ec);
-                        auto output_time = fs::last_write_time(cc.get_abs_path(), ec);
-
-                        return ec || !fs::exists(cc.get_abs_path()) || file_time > output_time;
-                    })
-        | cppxx::collect<std::vector>();
-
-    cppxx::multithreading::Channel<std::expected<void, std::runtime_error>> chan(jobs);
-    for (auto [i, cc] : filtered | cppxx::enumerate(1))
-        chan << [&, i]() -> std::expected<void, std::runtime_error> {
-            spdlog::info("[{}/{}] compiling {:?}", i, filtered.size(), cc.file);
-
-            try {
-                fs::create_directories(fs::path(cc.get_abs_path()).parent_path());
-            } catch (std::runtime_error &e) {
-                return cppxx::unexpected_errorf("Failed to compile {:?}: {}", cc.file, e.what());
+    std::vector<std::pair<std::string, CompileCommands>> outputs;
+    outputs.emplace_back(out, std::move(ccs));
+    return build(std::move(outputs), jobs);
+}
+
+static void load_build_log(BuildLog &log) {
+    if (auto res = log.load(); not res)
+        spdlog::warn("{}, rebuilding everything", res.error().what());
+}
+
+namespace {
+    struct Shared {
+        BuildLog log;
+        std::optional<Jobserver> jobserver;
+    };
+    std::unique_ptr<Shared> shared;
+} // namespace
+
+void share_build_state(int jobs) {
+    shared.reset(new Shared{.log = BuildLog((fs::path(std::getenv(CPPXX_CACHE)) / "build" / ".cppxx_log").string()), .jobserver = {}});
+    load_build_log(shared->log);
+    if (auto jobserver = Jobserver::from_env(jobs))
+        shared->jobserver.emplace(std::move(*jobserver));
+    else
+        spdlog::warn("{}, running without a jobserver", jobserver.error().what());
+}
+
+std::expected<void, std::runtime_error> build(std::vector<std::pair<std::string, CompileCommands>> &&outputs, int jobs) {
+    if (shared)
+        return build(std::move(outputs), jobs, shared->log, shared->jobserver ? &*shared->jobserver : nullptr, {});
+
+    BuildLog log((fs::path(std::getenv(CPPXX_CACHE)) / "build" / ".cppxx_log").string());
+    load_build_log(log);
+    auto jobserver = Jobserver::from_env(jobs);
+    if (not jobserver)
+        spdlog::warn("{}, running without a jobserver", jobserver.error().what());
+
+    return build(std::move(outputs), jobs, log, jobserver ? &*jobserver : nullptr, {});
+}
+
+std::expected<void, std::runtime_error> build(std::vector<std::pair<std::string, CompileCommands>> &&outputs,
+                                              int jobs,
+                                              BuildLog &log,
+                                              Jobserver *jobserver,
+                                              std::stop_token stop) {
+    const fs::path cache = std::getenv(CPPXX_CACHE);
+
+    // past durations from the build log drive the critical path priorities
+    auto cost_of = [&](const std::string &output) -> int64_t {
+        const auto entry = log.find(output);
+        return entry ? entry->duration : 1;
+    };
+
+    ObjectCache objects = ObjectCache::from_env(cache.string());
+    Workers workers = Workers::from_env();
+    std::atomic_size_t started = 0;
+    std::atomic_bool worked = false;
+    Scheduler scheduler;
+
+    // precompiled headers, by the prefix header the compile commands refer to. The ones out of date get a node
+    // that the compiles using them wait for
+    DependencyGraph graph(log);
+    std::unordered_map<std::string, const CompileCommand *> pchs;
+    std::unordered_map<std::string, size_t> pch_nodes;
+    for (const auto &[_, ccs] : outputs)
+        for (const auto &pch : ccs.pchs)
+            if (pchs.emplace(pch.file, &pch).second and graph.is_dirty(pch))
+                pch_nodes.emplace(pch.file, scheduler.add({
+                                                .name = pch.file,
+                                                .run = [&, cc = &pch]() {
+                                                    spdlog::info("precompiling {:?}", cc->file);
+                                                    return once<void>(cc->get_abs_path() + '\n' + cc->command,
+                                                                      [&]() { return precompile(*cc, graph, stop); });
+                                                },
+                                                .cost = cost_of(pch.get_abs_path()),
+                                                .category = "compile",
+                                            }));
+
+    // module units are scanned before anything else is compiled, see modules.h
+    std::vector<const CompileCommand *> units;
+    std::unordered_set<std::string> seen;
+    for (const auto &[_, ccs] : outputs)
+        for (const auto &cc : ccs.ccs)
+            if (not cc.modules().empty() and seen.insert(cc.get_abs_path()).second)
+                units.push_back(&cc);
+
+    auto modules = Modules::New(units, graph, jobs, jobserver, stop);
+    if (not modules)
+        return cppxx::unexpected_move(modules);
+
+    // whether `input` has been rebuilt since `cc` was built
+    auto rebuilt_since = [&](const CompileCommand &input, const CompileCommand &cc) {
+        const auto object = log.find(cc.get_abs_path());
+        const auto built = log.find(input.get_abs_path());
+        return object and built and built->mtime > object->mtime;
+    };
+
+    // an object is out of date as well if its precompiled header or a module it imports is rebuilt now, or has been
+    // since the object was built
+    std::unordered_map<std::string, bool> stale;
+    std::function<bool(const CompileCommand &)> is_stale = [&](const CompileCommand &cc) {
+        const std::string object = cc.get_abs_path();
+        if (auto it = stale.find(object); it != stale.end())
+            return it->second;
+
+        bool dirty = graph.is_dirty(cc);
+        if (auto it = pchs.find(cc.pch()); it != pchs.end())
+            dirty = dirty or pch_nodes.contains(cc.pch()) or rebuilt_since(*it->second, cc);
+        for (const auto *provider : modules->providers(cc))
+            dirty = is_stale(*provider) or rebuilt_since(*provider, cc) or dirty;
+        return stale[object] = dirty;
+    };
+
+    // identical compile commands of different targets share their output name, so they are only built once
+    seen.clear();
+    std::vector<const CompileCommand *> filtered;
+    for (const auto &[_, ccs] : outputs)
+        for (const auto &cc : ccs.ccs)
+            if (seen.insert(cc.get_abs_path()).second and is_stale(cc))
+                filtered.push_back(&cc);
+
+    std::unordered_map<std::string, size_t> compile_nodes;
+    for (const auto *cc : filtered) {
+        std::vector<size_t> deps;
+        if (auto it = pch_nodes.find(cc->pch()); it != pch_nodes.end())
+            deps.push_back(it->second);
+
+        compile_nodes.emplace(cc->get_abs_path(),
+                              scheduler.add({
+                                  .name = cc->file,
+                                  .run = [&, cc]() {
+                                      spdlog::info("[{}/{}] compiling {:?}", ++started, filtered.size(), cc->file);
+                                      return once<void>(cc->get_abs_path() + '\n' + cc->command,
+                                                        [&]() { return compile(*cc, modules->find(*cc), graph, objects, workers, stop); });
+                                  },
+                                  .deps = std::move(deps),
+                                  .cost = cost_of(cc->get_abs_path()),
+                                  .category = "compile",
+                              }));
+    }
+
+    // importers wait for the units providing their modules
+    for (const auto *cc : filtered)
+        for (const auto *provider : modules->providers(*cc))
+            if (auto it = compile_nodes.find(provider->get_abs_path()); it != compile_nodes.end())
+                scheduler.depend(compile_nodes.at(cc->get_abs_path()), it->second);
+
+    // archives are shared by every consumer as well
+    struct ArchiveNode {
+        size_t node;
+        bool changed;
+    };
+    std::unordered_map<std::string, ArchiveNode> archive_nodes;
+    auto add_archive = [&](const Archive &a) -> ArchiveNode {
+        if (auto it = archive_nodes.find(a.output); it != archive_nodes.end())
+            return it->second;
+
+        std::vector<size_t> deps;
+        for (const auto &object : a.objects)
+            if (auto it = compile_nodes.find(object); it != compile_nodes.end())
+                deps.push_back(it->second);
+
+        const bool changed = not deps.empty();
+        const size_t node = scheduler.add({
+            .name = a.output,
+            .run = [&, changed]() { return archive(log, a, changed, jobs, stop).transform([&](bool ran) { worked = worked or ran; }); },
+            .deps = std::move(deps),
+            .cost = cost_of(a.output),
+            .category = "archive",
+        });
+        return archive_nodes.emplace(a.output, ArchiveNode{node, changed}).first->second;
+    };
+
+    // one link node per output, started as soon as its own objects and archives are ready
+    struct LinkInputs {
+        std::vector<std::string> inputs;
+        std::unordered_set<std::string> link_flags;
+    };
+    std::vector<LinkInputs> links(outputs.size());
+
+    for (auto &&[i, output] : outputs | cppxx::enumerate(size_t(0))) {
+        auto &[out, ccs] = output;
+        auto &[inputs, link_flags] = links[i];
+        link_flags = ccs.link_flags;
+
+        // objects of lib targets go into their archives, everything else is linked directly
+        std::unordered_set<std::string> archived;
+        std::vector<size_t> link_deps;
+        bool changed = false;
+
+        for (const auto &a : ccs.archives) {
+            archived.insert(a.objects.begin(), a.objects.end());
+            auto [node, archive_changed] = add_archive(a);
+            link_deps.push_back(node);
+            changed = changed or archive_changed;
+
+            if (a.dynamic)
+                link_flags.insert(fmt::format("-Wl,-rpath,{}", fs::path(a.output).parent_path().string()));
+        }
+
+        for (const auto &cc : ccs.ccs) {
+            if (archived.contains(cc.get_abs_path()))
+                continue;
+            inputs.push_back(cc.get_abs_path());
+            if (auto it = compile_nodes.find(cc.get_abs_path()); it != compile_nodes.end()) {
+                link_deps.push_back(it->second);
+                changed = true;
             }
+        }
 
-            return system("cd " + cc.directory + " && " + cc.command);
-        };
+        for (const auto &a : ccs.archives)
+            inputs.push_back(a.output);
 
-    std::optional<std::runtime_error> err = std::nullopt;
-    while (not chan.empty())
-        chan >> [&](std::expected<void, std::runtime_error> res) {
-            if (not res)
-                err.emplace(std::move(res.error()));
-        };
+        scheduler.add({
+            .name = out,
+            .run = [&, i, changed]() {
+                return link(log, links[i].inputs, links[i].link_flags, outputs[i].second.linking, outputs[i].first, changed, jobs, stop)
+                    .transform([&](bool ran) { worked = worked or ran; });
+            },
+            .deps = std::move(link_deps),
+            .cost = cost_of(fs::absolute(out).string()),
+            .category = "link",
+        });
+    }
+
+    auto res = scheduler.run(jobs, jobserver, stop);
+
+    // keep whatever was compiled successfully, even if another job failed
+    if (auto saved = log.save(); not saved)
+        spdlog::warn("{}", saved.error().what());
+    if (not filtered.empty())
+        if (auto evicted = objects.evict(); not evicted)
+            spdlog::warn("{}", evicted.error().what());
 
-    if (err)
-        return std::unexpected(std::move(*err));
+    if (res and filtered.empty() and pch_nodes.empty() and not worked)
+        spdlog::info("no work to do");
 
+    return res;
+}
+
+
+using Outputs = std::vector<std::pair<std::string, CompileCommands>>;
 
-    // TODO: static and shared libs?
-    const auto deps = ccs.ccs | cppxx::map([](const CompileCommand &cc) { return cc.get_abs_path(); });
-    const auto cmd = fmt::format("{} {} {} -o {}", "c++", fmt::join(deps, " "), fmt::join(ccs.link_flags, " "), out);
+// Every file the outputs are compiled from, headers included as far as the build log knows them. Generated unity
+// sources and prefix headers are left out, their own inputs are what changes
+static std::set<std::string> inputs_of(const Outputs &outputs, const BuildLog &log) {
+    const std::string generated = (fs::path(std::getenv(CPPXX_CACHE)) / "build").lexically_normal().string() + '/';
 
-    spdlog::info("building {}", out);
-    if (auto res = system(cmd); not res)
-        return cppxx::unexpected_errorf("Failed to build {:?}, {}", out, res.error().what());
+    std::set<std::string> inputs;
+    auto add = [&](const fs::path &path) {
+        if (auto input = fs::absolute(path).lexically_normal().string(); not input.starts_with(generated))
+            inputs.insert(std::move(input));
+    };
+    auto add_with_deps = [&](const CompileCommand &cc) {
+        add(fs::path(cc.directory) / cc.file);
+        if (const auto entry = log.find(cc.get_abs_path()))
+            for (auto dep : entry->deps)
+                add(log.path_of(dep));
+    };
+
+    for (const auto &[_, ccs] : outputs) {
+        std::ranges::for_each(ccs.ccs, add_with_deps);
+        std::ranges::for_each(ccs.pchs, add_with_deps);
+    }
+    return inputs;
+}
 
-    return {};
+// Files that may be picked up by a glob or included by a source, other new or removed files do not affect the build
+static bool is_source_like(const fs::path &path) {
+    static const std::set<std::string> extensions = {
+        ".c", ".cc", ".cpp", ".cxx", ".c++", ".cppm", ".ixx", ".mpp", ".h", ".hh", ".hpp", ".hxx", ".h++", ".ipp", ".inl", ".tpp",
+    };
+    return extensions.contains(path.extension().string());
 }
 
+static volatile std::sig_atomic_t interrupted = 0;
+
+extern "C" void on_interrupt(int sig) { interrupted = sig; }
+
+// Rebuild whenever an input changes, until interrupted. The compile commands, the build log and the jobserver stay in
+// memory between builds, the workspace is only resolved again when the config changes or files come and go.
+// A build still running when the next change arrives is cancelled, its results would be obsolete anyway
+static std::expected<void, std::runtime_error> watch(const std::string &root_dir,
+                                                     const std::function<std::expected<Outputs, std::runtime_error>()> &prepare,
+                                                     const std::vector<std::string> &globbed,
+                                                     int jobs,
+                                                     const std::set<std::string> &written,
+                                                     const std::function<void()> &finished) {
+    auto watcher = Watcher::New();
+    if (not watcher)
+        return cppxx::unexpected_move(watcher);
+
+    // the commands of a build run in process groups of their own and miss a Ctrl-C, they are cancelled instead
+    struct sigaction action = {}, previous_int = {}, previous_term = {};
+    action.sa_handler = on_interrupt;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, &previous_int);
+    ::sigaction(SIGTERM, &action, &previous_term);
+    cppxx::defer restore = [&]() {
+        ::sigaction(SIGINT, &previous_int, nullptr);
+        ::sigaction(SIGTERM, &previous_term, nullptr);
+    };
+
+    BuildLog log((fs::path(std::getenv(CPPXX_CACHE)) / "build" / ".cppxx_log").string());
+    load_build_log(log);
+    auto jobserver = Jobserver::from_env(jobs);
+    if (not jobserver)
+        spdlog::warn("{}, running without a jobserver", jobserver.error().what());
+
+    const fs::path root = fs::absolute(root_dir.empty() ? "." : root_dir).lexically_normal();
+    const std::set<std::string> configs = {(root / "cppxx.toml").string(), (root / "cppxx.json").string()};
+    const std::string cache = fs::absolute(std::getenv(CPPXX_CACHE)).lexically_normal().string() + '/';
+
+    Outputs outputs;
+    std::set<std::string> inputs, watched, own;
+    std::atomic_bool done = false;
+    std::jthread builder;
+
+    for (bool resolve = true;;) {
+        if (auto prepared = resolve ? prepare() : std::move(outputs); prepared) {
+            outputs = std::move(*prepared);
+            own = written;
+            for (const auto &[out, _] : outputs)
+                own.insert(fs::absolute(out).lexically_normal().string());
+            done = false;
+            builder = std::jthread([&, copy = outputs](std::stop_token stop) mutable {
+                Trace::Scope _("build", "phase");
+                if (auto res = build(std::move(copy), jobs, log, jobserver ? &*jobserver : nullptr, stop); not res and not stop.stop_requested())
+                    spdlog::error("{}", res.error().what());
+                finished();
+                done = true;
+            });
+        } else {
+            spdlog::error("{}", prepared.error().what());
+            done = true;
+        }
+
+        // the headers of the inputs are only known once the build has run
+        for (bool watching = false;;) {
+            if (not watching and done) {
+                if (builder.joinable())
+                    builder.join();
+
+                inputs = inputs_of(outputs, log);
+                std::set<std::string> dirs = {root.string()};
+                for (const auto &input : inputs)
+                    dirs.insert(fs::path(input).parent_path().string());
+                for (const auto &dir : globbed)
+                    dirs.insert(fs::absolute(dir).lexically_normal().string());
+
+                watcher->watch(dirs);
+                watched = std::move(dirs);
+                spdlog::info("watching {} directories for changes", watcher->size());
+                watching = true;
+            }
+
+            auto changes = watcher->wait(std::chrono::milliseconds(watching ? 1000 : 100));
+            if (const int sig = interrupted) {
+                builder.request_stop();
+                if (builder.joinable())
+                    builder.join();
+                return cppxx::unexpected_errorf("Interrupted by signal {}, exited with return code {}", sig, 128 + sig);
+            }
+            if (not changes)
+                return cppxx::unexpected_move(changes);
+
+            // the outputs, the trace and the cache are written by the build itself, even while it is being watched
+            auto is_own = [&](const std::string &path) { return path.starts_with(cache) or own.contains(path); };
+            for (auto *paths : {&changes->written, &changes->created, &changes->removed})
+                std::erase_if(*paths, is_own);
+            if (changes->empty())
+                continue;
+
+            // new files may match a glob, removed ones no longer exist, both need a fresh workspace
+            auto is_input = [&](const std::string &path) { return inputs.contains(path) and not configs.contains(path); };
+            auto is_config = [&](const std::string &path) { return configs.contains(path); };
+            auto is_relevant = [&](const std::string &path) {
+                return inputs.contains(path) or configs.contains(path) or watched.contains(path) or is_source_like(path);
+            };
+            resolve = changes->overflow or std::ranges::any_of(changes->removed, is_relevant)
+                or std::ranges::any_of(changes->created, [&](const auto &path) { return not is_input(path) and is_relevant(path); })
+                or std::ranges::any_of(changes->written, is_config);
+            if (not resolve and std::ranges::none_of(changes->written, is_input) and std::ranges::none_of(changes->created, is_input))
+                continue;
+
+            std::set<std::string> changed = changes->written;
+            changed.insert(changes->created.begin(), changes->created.end());
+            changed.insert(changes->removed.begin(), changes->removed.end());
+            spdlog::info("{} changed, rebuilding", changed.size() == 1 ? fmt::format("{:?}", *changed.begin())
+                                                                       : fmt::format("{} files", changed.size()));
+            break;
+        }
+
+        builder.request_stop();
+        if (builder.joinable())
+            builder.join();
+    }
+}
+
+
+static std::optional<std::string> read_file(const fs::path &path) {
+    std::ifstream is(path, std::ios::binary);
+    if (not is.is_open())
+        return std::nullopt;
+    std::stringstream ss;
+    ss << is.rdbuf();
+    return ss.str();
+}
+
+// Compile and link every target with `flags` as well
+static void add_flags(Workspace &w, const std::vector<std::string> &flags) {
+    for (auto *targets : {&w.interface, &w.lib, &w.bin}) {
+        if (not *targets)
+            continue;
+        for (auto &[_, t] : **targets) {
+            if (not t.flags)
+                t.flags = std::vector<std::string>{};
+            auto &own = std::holds_alternative<Extended>(*t.flags) ? std::get<Extended>(*t.flags).private_()
+                                                                   : std::get<std::vector<std::string>>(*t.flags);
+            own.insert(own.end(), flags.begin(), flags.end());
+
+            if (not t.link_flags)
+                t.link_flags = std::vector<std::string>{};
+            t.link_flags->insert(t.link_flags->end(), flags.begin(), flags.end());
+        }
+    }
+}
+
+// Profile guided optimization in three stages, each skipped when its inputs are unchanged:
+// - the outputs are built instrumented into $CPPXX_CACHE/pgo/<workspace>/bin, incrementally like any build
+// - `train` runs with that directory first on PATH, only if the instrumented executables or `train` itself changed,
+//   and its profiles are merged into one named after its content
+// - the outputs are built with that profile, which is part of their compile commands, so a profile that came out the
+//   same leaves them as they are
+// `prepare` generates the compile commands with `profile` added to the flags of every target.
+//
+// GCC reads the profile of an object from a directory, by the path of the object (joined in older versions, mangled
+// with `#` in newer ones), so the counters of every instrumented object are copied there for its optimized twin
+static std::expected<void, std::runtime_error> pgo(const std::string &root_dir,
+                                                   const std::function<std::expected<Outputs, std::runtime_error>()> &prepare,
+                                                   std::vector<std::string> &profile,
+                                                   const std::string &train,
+                                                   int jobs) {
+    const fs::path root = fs::absolute(root_dir.empty() ? "." : root_dir).lexically_normal();
+    const fs::path ns = fs::path(std::getenv(CPPXX_CACHE)) / "pgo" / SHA256::hashString(root.string()).substr(0, 16);
+    const fs::path bin = ns / "bin", raw = ns / "raw", profiles = ns / "profiles";
+
+    auto plain = prepare();
+    if (not plain)
+        return cppxx::unexpected_move(plain);
+    if (plain->empty())
+        return {};
+    const Linking linking = plain->front().second.linking;
+    const bool clang = linking.clang();
+
+    auto gcda_of = [](const CompileCommand &cc) { return fs::path(cc.get_abs_path()).replace_extension(".gcda"); };
+
+    // instrumented
+    if (clang)
+        profile = {fmt::format("-fprofile-generate={}", raw.string())};
+    else
+        profile = {"-fprofile-generate", "-fprofile-update=prefer-atomic"};
+    auto instrumented = prepare();
+    if (not instrumented)
+        return cppxx::unexpected_move(instrumented);
+    for (auto &[out, _] : *instrumented)
+        out = (bin / fs::path(out).filename()).string();
+
+    spdlog::info("pgo: building the instrumented outputs");
+    if (auto res = build(Outputs(*instrumented), jobs); not res)
+        return res;
+
+    // trained
+    std::string key = train + '\n';
+    for (const auto &[out, _] : *instrumented)
+        key += fmt::format("{:x}\n", BuildLog::hash(read_file(out).value_or("")));
+    key = SHA256::hashString(key);
+
+    const fs::path stamp = ns / "trained";
+    std::string id;
+    if (auto trained = read_file(stamp); trained and trained->starts_with(key + ' '))
+        id = trained->substr(key.size() + 1);
+
+    std::error_code ec;
+    if (id.empty() or not fs::exists(clang ? profiles / (id + ".profdata") : profiles / id, ec)) {
+        // counters of earlier runs would add up with the new ones
+        if (clang)
+            fs::remove_all(raw, ec);
+        else
+            for (const auto &[_, ccs] : *instrumented)
+                for (const auto &cc : ccs.ccs)
+                    fs::remove(gcda_of(cc), ec);
+
+        spdlog::info("pgo: training with {:?}", train);
+        const std::string path = fmt::format("{:?}", bin.string());
+        if (auto res = system(fmt::format("export PATH={}:\"$PATH\"; {}", path, train)); not res)
+            return cppxx::unexpected_errorf("Training with {:?} failed: {}", train, res.error().what());
+
+        fs::create_directories(profiles, ec);
+        if (clang) {
+            std::vector<std::string> args = {tool_of(linking.driver, "", "llvm-profdata"), "merge", "-o"};
+            const std::string merged = (profiles / fmt::format("merged-{}.profdata", ::getpid())).string();
+            args.push_back(merged);
+            for (const auto &entry : fs::directory_iterator(raw, ec))
+                if (entry.path().extension() == ".profraw")
+                    args.push_back(entry.path().string());
+            if (args.size() == 4)
+                return cppxx::unexpected_errorf("Training with {:?} wrote no profile, did it run the outputs in {:?}?", train, bin.string());
+            if (auto res = spawn(args); not res)
+                return cppxx::unexpected_errorf("Cannot merge the profiles: {}", res.error().what());
+
+            id = SHA256::hashString(read_file(merged).value_or("")).substr(0, 16);
+            if (fs::rename(merged, profiles / (id + ".profdata"), ec); ec)
+                return cppxx::unexpected_errorf("Cannot write the profile {:?}: {}", id, ec.message());
+        } else {
+            std::string counters;
+            for (const auto &[_, ccs] : *instrumented)
+                for (const auto &cc : ccs.ccs)
+                    if (auto gcda = read_file(gcda_of(cc)))
+                        counters += fmt::format("{}\n{:x}\n", cc.get_abs_path(), BuildLog::hash(*gcda));
+            if (counters.empty())
+                return cppxx::unexpected_errorf("Training with {:?} wrote no profile, did it run the outputs in {:?}?", train, bin.string());
+
+            id = SHA256::hashString(counters).substr(0, 16);
+            fs::create_directories(profiles / id, ec);
+        }
+
+        if (std::ofstream os(stamp); not (os << key << ' ' << id))
+            spdlog::warn("Cannot write {:?}, the next build trains again", stamp.string());
+    } else {
+        spdlog::info("pgo: the instrumented outputs are unchanged, reusing the profile of the last training");
+    }
+
+    // optimized
+    profile = {fmt::format("-fprofile-use={}", (clang ? profiles / (id + ".profdata") : profiles / id).string())};
+    auto optimized = prepare();
+    if (not optimized)
+        return cppxx::unexpected_move(optimized);
+
+    if (not clang) {
+        for (const auto &[generating, using_] : std::views::zip(*instrumented, *optimized)) {
+            if (generating.second.ccs.size() != using_.second.ccs.size())
+                continue;
+            for (const auto &[from, to] : std::views::zip(generating.second.ccs, using_.second.ccs)) {
+                const std::string object = gcda_of(to).string();
+                std::string mangled = object;
+                std::ranges::replace(mangled, '/', '#');
+                for (const auto &dest : {profiles / id / object.substr(1), profiles / id / mangled}) {
+                    fs::create_directories(dest.parent_path(), ec);
+                    fs::copy_file(gcda_of(from), dest, fs::copy_options::skip_existing, ec);
+                }
+            }
+        }
+    }
+
+    spdlog::info("pgo: building the optimized outputs");
+    return build(std::move(*optimized), jobs);
+}
+
+
+// time a step of the pipeline in the trace
+template <typename F>
+static auto phase(const char *name, F &&fn) {
+    return [name, fn = std::forward<F>(fn)](Workspace &&w) {
+        Trace::Scope _(name, "phase");
+        return fn(std::move(w));
+    };
+}
 
 std::expected<void, std::runtime_error> Build::exec() {
-    if (not out)
-        out = target;
-
-    return Workspace::New(root.value_or(""))
-        .and_then(resolve_vars)
-        .and_then([&](Workspace &&w) { return resolve_target(std::move(w), target); })
-        .and_then(resolve_remotes)
-        .and_then(resolve_paths)
-        .and_then([&](Workspace &&w) { return generate_compile_commands(w, target); })
-        .and_then([&](CompileCommands &&ccs) { return build(std::move(ccs), *jobs, *out); });
+    if (all and out)
+        return cppxx::unexpected_errorf("{:?} cannot be combined with {:?}, every target would be written to it", "--out", "--all");
+    if (all)
+        targets = std::vector<std::string>{};
+    else if (not targets or targets->empty())
+        return cppxx::unexpected_errorf("No target specified, use {:?} to build every bin target", "--all");
+    if (targets and targets->size() > 1 and out)
+        return cppxx::unexpected_errorf("{:?} can only be used with a single target", "--out");
+    if (trace)
+        Trace::enable();
+    if (time_trace and not trace)
+        return cppxx::unexpected_errorf("{:?} requires {:?}", "--time-trace", "--trace");
+
+    if (pgo and watch)
+        return cppxx::unexpected_errorf("{:?} cannot be combined with {:?}", "--pgo", "--watch");
+
+    const std::string scope = all ? "--all" : fmt::format("{}", fmt::join(targets.value_or(std::vector<std::string>{}), " "));
+    auto resolve = [&]() {
+        return Workspace::New(root.value_or(""))
+            .and_then(phase("resolve_vars", resolve_vars))
+            .and_then(phase("resolve_target", [&](Workspace &&w) -> std::expected<Workspace, std::runtime_error> {
+                std::vector<std::string> names = targets.value_or(std::vector<std::string>{});
+                if (all and w.bin)
+                    for (const auto &[name, _] : w.bin.value())
+                        names.push_back(name);
+                if (names.empty())
+                    return cppxx::unexpected_errorf("No bin target to build");
+
+                return resolve_target(std::move(w), names);
+            }))
+            .and_then(phase("resolve_remotes", resolve_remotes))
+            .and_then(phase("resolve_paths", resolve_paths));
+    };
+
+    std::vector<std::string> globbed;
+    std::vector<std::string> profile; // flags of the stage of `--pgo`
+    auto prepare = [&]() {
+        return resolve_cached(root.value_or(""), scope, resolve)
+            .and_then([&](Workspace &&w) -> std::expected<Workspace, std::runtime_error> {
+                // the snapshot of `--all` does not know the names yet
+                if (all) {
+                    targets->clear();
+                    if (w.bin)
+                        for (const auto &[name, _] : w.bin.value())
+                            targets->push_back(name);
+                }
+                std::ranges::sort(*targets);
+                globbed = w.globbed();
+                return std::move(w);
+            })
+            .and_then(phase("generate_compile_commands", [&](Workspace &&w) -> std::expected<Outputs, std::runtime_error> {
+                add_flags(w, profile);
+                Outputs outputs;
+                for (const auto &target : *targets) {
+                    auto ccs = generate_compile_commands(w, target);
+                    if (not ccs)
+                        return cppxx::unexpected_move(ccs);
+
+                    // clang writes <object>.json next to every object
+                    if (time_trace)
+                        for (auto &cc : ccs->ccs) {
+                            cc.command += " -ftime-trace";
+                            cc.base_command() += " -ftime-trace";
+                        }
+
+                    outputs.emplace_back(out.value_or(target), std::move(*ccs));
+                }
+                return outputs;
+            }));
+    };
+
+    auto save_trace = [&]() {
+        if (trace)
+            if (auto saved = Trace::save(*trace); not saved)
+                spdlog::warn("{}", saved.error().what());
+    };
+
+    const int n = jobs.value_or(std::max<int>(std::thread::hardware_concurrency(), 1));
+    if (watch) {
+        std::set<std::string> written;
+        if (trace)
+            written.insert(fs::absolute(*trace).lexically_normal().string());
+        return ::watch(root.value_or(""), prepare, globbed, n, written, save_trace);
+    }
+    if (pgo) {
+        auto res = ::pgo(root.value_or(""), prepare, profile, *pgo, n);
+        save_trace();
+        return res;
+    }
+
+    auto res = prepare().and_then([&](Outputs &&outputs) {
+        Trace::Scope _("build", "phase");
+        return build(std::move(outputs), n);
+    });
+    save_trace();
+
+    return res;
 }
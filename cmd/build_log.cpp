@@ -0,0 +1,214 @@
+#include <fmt/ranges.h>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ranges>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "build_log.h"
+
+namespace fs = std::filesystem;
+
+static constexpr std::string_view header = "# cppxx log v3";
+
+
+static std::vector<std::string_view> split(std::string_view line, char delim) {
+    std::vector<std::string_view> fields;
+    for (size_t pos; (pos = line.find(delim)) != std::string_view::npos; line.remove_prefix(pos + 1))
+        fields.push_back(line.substr(0, pos));
+    fields.push_back(line);
+    return fields;
+}
+
+template <typename T>
+static bool parse_number(std::string_view s, T &value, int base = 10) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value, base);
+    return ec == std::errc() and ptr == s.data() + s.size();
+}
+
+
+BuildLog::BuildLog(std::string path)
+    : file(std::move(path)) {}
+
+std::expected<void, std::runtime_error> BuildLog::load() {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? std::expected<void, std::runtime_error>{}
+                               : cppxx::unexpected_errorf("Cannot open build log {:?}: {}", file, std::strerror(errno));
+    cppxx::defer _ = [&]() { ::close(fd); };
+
+    struct stat st = {};
+    if (::fstat(fd, &st) < 0)
+        return cppxx::unexpected_errorf("Cannot stat build log {:?}: {}", file, std::strerror(errno));
+    if (st.st_size == 0)
+        return {};
+
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return cppxx::unexpected_errorf("Cannot mmap build log {:?}: {}", file, std::strerror(errno));
+    cppxx::defer __ = [&]() { ::munmap(data, st.st_size); };
+
+    std::string_view content(static_cast<const char *>(data), st.st_size);
+    if (not content.starts_with(header)) // unknown version, start over
+        return {};
+
+    // ids in the file are local to the file, translate them into ours
+    std::vector<uint32_t> local;
+    for (size_t pos; not content.empty(); content.remove_prefix(pos == std::string_view::npos ? content.size() : pos + 1)) {
+        pos = content.find('\n');
+        const std::string_view line = content.substr(0, pos);
+
+        if (line.starts_with("p\t")) {
+            local.push_back(intern(line.substr(2)));
+        } else if (line.starts_with("o\t")) {
+            auto fields = split(line.substr(2), '\t');
+            uint32_t output = 0;
+            Entry entry = {};
+            if (fields.size() < 5 or not parse_number(fields[0], output) or output >= local.size()
+                or not parse_number(fields[1], entry.command_hash, 16) or not parse_number(fields[2], entry.mtime)
+                or not parse_number(fields[3], entry.inputs_hash, 16) or not parse_number(fields[4], entry.duration))
+                continue; // truncated or corrupted record, the output is simply rebuilt
+
+            bool ok = true;
+            for (auto field : fields | std::views::drop(5)) {
+                uint32_t dep = 0;
+                if (not parse_number(field, dep) or dep >= local.size()) {
+                    ok = false;
+                    break;
+                }
+                entry.deps.push_back(local[dep]);
+            }
+
+            if (ok)
+                entries.insert_or_assign(local[output], std::move(entry));
+        }
+    }
+
+    return {};
+}
+
+std::expected<void, std::runtime_error> BuildLog::save() {
+    std::lock_guard lock(mutex);
+    if (recorded.empty())
+        return {};
+
+    // another cppxx process may have updated the log in the meantime, keep its records
+    BuildLog merged(file);
+    if (auto res = merged.load(); not res)
+        return res;
+
+    for (auto id : recorded) {
+        const Entry &entry = entries.at(id);
+        Entry translated = {
+            .command_hash = entry.command_hash,
+            .mtime = entry.mtime,
+            .inputs_hash = entry.inputs_hash,
+            .duration = entry.duration,
+        };
+        for (auto dep : entry.deps)
+            translated.deps.push_back(merged.intern(paths[dep]));
+        merged.entries.insert_or_assign(merged.intern(paths[id]), std::move(translated));
+    }
+
+    // only write the paths that are still referenced, compacting the log on every save
+    std::vector<int64_t> local(merged.paths.size(), -1);
+    int64_t next = 0;
+    std::string out = fmt::format("{}\n", header);
+    auto local_id = [&](uint32_t id) {
+        if (local[id] < 0) {
+            local[id] = next++;
+            out += fmt::format("p\t{}\n", merged.paths[id]);
+        }
+        return local[id];
+    };
+
+    for (const auto &[id, entry] : merged.entries) {
+        std::vector<int64_t> deps;
+        for (auto dep : entry.deps)
+            deps.push_back(local_id(dep));
+        out += fmt::format("o\t{}\t{:x}\t{}\t{:x}\t{}{}{}\n", local_id(id), entry.command_hash, entry.mtime, entry.inputs_hash,
+                           entry.duration, deps.empty() ? "" : "\t", fmt::join(deps, "\t"));
+    }
+
+    const std::string tmp = fmt::format("{}.{}.tmp", file, ::getpid());
+    try {
+        fs::create_directories(fs::path(file).parent_path());
+        std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+        os << out;
+        if (not os.flush())
+            return cppxx::unexpected_errorf("Cannot write build log {:?}", tmp);
+        os.close();
+        fs::rename(tmp, file);
+    } catch (std::exception &e) {
+        return cppxx::unexpected_errorf("Cannot save build log {:?}: {}", file, e.what());
+    }
+
+    recorded.clear();
+    return {};
+}
+
+std::optional<BuildLog::Entry> BuildLog::find(const std::string &output) const {
+    std::lock_guard lock(mutex);
+    if (auto id = ids.find(output); id != ids.end())
+        if (auto it = entries.find(id->second); it != entries.end())
+            return it->second;
+    return std::nullopt;
+}
+
+std::string BuildLog::path_of(uint32_t id) const {
+    std::lock_guard lock(mutex);
+    return paths[id];
+}
+
+size_t BuildLog::size() const {
+    std::lock_guard lock(mutex);
+    return paths.size();
+}
+
+void BuildLog::record(const std::string &output,
+                      uint64_t command_hash,
+                      int64_t mtime,
+                      uint64_t inputs_hash,
+                      int64_t duration,
+                      const std::vector<std::string> &deps) {
+    std::lock_guard lock(mutex);
+    Entry entry = {.command_hash = command_hash, .mtime = mtime, .inputs_hash = inputs_hash, .duration = duration};
+    for (const auto &dep : deps)
+        entry.deps.push_back(intern(dep));
+
+    auto id = intern(output);
+    entries.insert_or_assign(id, std::move(entry));
+    recorded.insert(id);
+}
+
+void BuildLog::touch(const std::string &output, int64_t mtime) {
+    std::lock_guard lock(mutex);
+    auto id = intern(output);
+    if (auto it = entries.find(id); it != entries.end()) {
+        it->second.mtime = mtime;
+        recorded.insert(id);
+    }
+}
+
+uint64_t BuildLog::hash(std::string_view data) {
+    // 64-bit FNV-1a, stable across runs and platforms unlike std::hash
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint32_t BuildLog::intern(std::string_view path) {
+    if (auto it = ids.find(std::string(path)); it != ids.end())
+        return it->second;
+
+    paths.emplace_back(path);
+    return ids.emplace(paths.back(), paths.size() - 1).first->second;
+}
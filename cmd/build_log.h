@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+// Persistent record of every object produced by `cppxx build`, similar to ninja's `.ninja_log` + `.ninja_deps`.
+// Paths are interned, so a header shared by many translation units is stored once.
+//
+// File format (one record per line, fields separated by tabs):
+//   # cppxx log v3
+//   p <path>                                                                    defines the path with the next id
+//   o <output-id> <command-hash> <mtime> <inputs-hash> <duration> <dep-id>...   an output and its prerequisites
+class BuildLog {
+public:
+    struct Entry {
+        uint64_t command_hash = 0;
+        int64_t mtime = 0;
+        uint64_t inputs_hash = 0; // combined content hash of every prerequisite
+        int64_t duration = 0;     // how long producing the output took in milliseconds, used to schedule long poles first
+        std::vector<uint32_t> deps = {};
+    };
+
+    explicit BuildLog(std::string path);
+
+    // mmap the log file once and index it, a missing file is an empty log
+    std::expected<void, std::runtime_error> load();
+
+    // merge the recorded entries into the log on disk and atomically replace it
+    std::expected<void, std::runtime_error> save();
+
+    // copies, the daemon records entries of concurrent builds into the same log
+    std::optional<Entry> find(const std::string &output) const;
+    void record(const std::string &output,
+                uint64_t command_hash,
+                int64_t mtime,
+                uint64_t inputs_hash,
+                int64_t duration,
+                const std::vector<std::string> &deps);
+
+    // refresh the mtime of an output whose prerequisites were touched but not changed
+    void touch(const std::string &output, int64_t mtime);
+
+    std::string path_of(uint32_t id) const;
+    size_t size() const;
+
+    static uint64_t hash(std::string_view data);
+
+private:
+    uint32_t intern(std::string_view path);
+
+    std::string file;
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::unordered_map<uint32_t, Entry> entries;
+    std::unordered_set<uint32_t> recorded;
+    mutable std::mutex mutex;
+};
@@ -1,3 +1,4 @@
+#include <fmt/ranges.h>
 #include <filesystem>
 #include "compile_command.h"
 
@@ -15,3 +16,10 @@ std::string CompileCommand::get_abs_path() const {
     return out.string();
 }
 
+std::string CompileCommand::get_dep_path() const { return fs::path(get_abs_path()).replace_extension(".d").string(); }
+
+std::string CompileCommand::get_preprocess_command(const std::string &out) const {
+    // the prefix header is expanded as text, so that the output covers it and a worker needs nothing else
+    const std::string include = pch().empty() ? "" : fmt::format(" -include {}", pch());
+    return fmt::format("{}{} -MMD -MF {} -E {} -o {}", base_command(), include, get_dep_path(), file, out);
+}
@@ -4,11 +4,37 @@
 
 struct CompileCommand {
     std::string file, directory, command, output;
+    rfl::Skip<std::string> base_command = {}; // compiler and flags only, without inputs and outputs
+    rfl::Skip<std::string> pch = {};          // the prefix header this source is compiled with, if any
+    rfl::Skip<std::string> modules = {};      // the module map the command reads, if its target uses modules
 
     std::string get_abs_path() const;
+    std::string get_dep_path() const;
+    std::string get_preprocess_command(const std::string &out) const;
+};
+
+// How objects are linked into an executable or a shared library
+struct Linking {
+    std::string driver = "c++"; // the compiler driving the link
+    std::string linker = "";    // for `-fuse-ld`, empty for the default of the driver
+    std::string lto = "";       // "full" or "thin", empty without LTO
+
+    bool clang() const { return driver.contains("clang"); }
+};
+
+// Objects of a lib target bundled into a static archive, or a shared library if the target is `dynamic`
+struct Archive {
+    std::string name, output;
+    std::vector<std::string> objects;
+    std::vector<std::string> link_flags = {}; // only used to link a shared library
+    bool dynamic = false;
+    Linking linking = {};
 };
 
 struct CompileCommands {
     std::vector<CompileCommand> ccs;
     std::unordered_set<std::string> link_flags;
+    std::vector<Archive> archives = {}; // in link order, dependents before their dependencies
+    std::vector<CompileCommand> pchs = {}; // precompiled prefix headers, `file` is the header `pch` of a source refers to
+    Linking linking = {};
 };
@@ -0,0 +1,294 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/base_sink.h>
+#include <rfl/json.hpp>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <sha256.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "daemon.h"
+#include "options.h"
+#include "socket.h"
+#include "system.h"
+#include "workspace.h"
+
+namespace fs = std::filesystem;
+
+extern char **environ;
+
+
+// The protocol is one JSON object per line: the client sends a Request, the daemon answers with any number of
+// Replies carrying output, followed by the final one which is `done`
+namespace {
+    struct Request {
+        std::string cwd;
+        std::vector<std::string> args; // the subcommand and its arguments
+        std::vector<std::string> env;  // `NAME=value`, as returned by environment()
+    };
+
+    struct Reply {
+        std::optional<std::string> output = std::nullopt; // log lines and compiler diagnostics, as they come
+        std::optional<bool> done = std::nullopt;
+        std::optional<std::string> error = std::nullopt;
+        std::optional<std::vector<std::string>> exec = std::nullopt; // `run`: the command for the client to execute
+        std::optional<bool> local = std::nullopt; // the client has to run the subcommand itself, e.g. its environment differs
+    };
+
+    // Variables referenced by cppxx.toml, CPPXX_CACHE, PATH and the compiler all shape the build, so a daemon only
+    // serves clients with the same environment. Those that differ between shells of the same user are left out
+    std::vector<std::string> environment() {
+        constexpr std::string_view ignored[] = {"_", "OLDPWD", "PWD", "SHLVL", "COLUMNS", "LINES"};
+        std::vector<std::string> env;
+        for (char **var = environ; var and *var; ++var) {
+            const std::string_view entry = *var;
+            if (std::ranges::find(ignored, entry.substr(0, entry.find('='))) == std::end(ignored))
+                env.emplace_back(entry);
+        }
+        std::ranges::sort(env);
+        return env;
+    }
+
+    // one per client connection, the workers of its build write to it concurrently
+    struct Session {
+        int fd;
+        std::mutex mutex;
+
+        void send(const Reply &reply) {
+            std::lock_guard lock(mutex);
+            send_all(fd, rfl::json::write(reply) + '\n');
+        }
+    };
+
+    // passes the log of a thread working for a client on to that client
+    class ClientSink : public spdlog::sinks::base_sink<std::mutex> {
+    protected:
+        void sink_it_(const spdlog::details::log_msg &msg) override {
+            if (not thread_sink())
+                return;
+            spdlog::memory_buf_t formatted;
+            formatter_->format(msg, formatted);
+            print_stderr(std::string_view(formatted.data(), formatted.size()));
+        }
+        void flush_() override {}
+    };
+
+    // one daemon per directory, since relative paths in the workspace and in the arguments are resolved against it
+    std::expected<std::string, std::runtime_error> socket_path() {
+        const char *cache = std::getenv(CPPXX_CACHE);
+        if (not cache)
+            return cppxx::unexpected_errorf("env varibale {:?} is not defined", CPPXX_CACHE);
+
+        const auto path = fs::path(cache) / "daemon" / (SHA256::hashString(fs::current_path().string()).substr(0, 16) + ".sock");
+        if (path.string().size() >= sizeof(sockaddr_un::sun_path))
+            return cppxx::unexpected_errorf("Socket path {:?} is too long", path.string());
+        return path.string();
+    }
+
+    sockaddr_un address_of(const std::string &path) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::ranges::copy(path, addr.sun_path);
+        return addr;
+    }
+
+    int connect_to(const std::string &path) {
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        const sockaddr_un addr = address_of(path);
+        if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    std::expected<void, std::runtime_error> handle(const std::vector<std::string> &args, Reply &reply) {
+        const std::string name = fmt::format("cppxx {}", args[0]);
+        std::vector<char *> argv = {const_cast<char *>(name.c_str())};
+        for (const auto &arg : args | std::views::drop(1))
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        const int argc = int(argv.size());
+        argv.push_back(nullptr);
+
+        try {
+            if (args[0] == "build") {
+                Build build(name, argc, argv.data(), cppxx::cli::parse_or_throw);
+                // they outlive a request or write for the client, so the client builds itself
+                if (build.watch or build.trace or build.pgo) {
+                    reply.local = true;
+                    return {};
+                }
+                return build.exec();
+            }
+
+            if (args[0] == "compile_commands")
+                return GenerateCompileCommands(name, argc, argv.data(), cppxx::cli::parse_or_throw).exec();
+
+            // the executable runs in the terminal of the client
+            if (args[0] == "run") {
+                Run run(name, argc, argv.data(), cppxx::cli::parse_or_throw);
+                return run.compile().transform([&](std::string &&output) {
+                    run.args.insert(run.args.begin(), std::move(output));
+                    reply.exec = std::move(run.args);
+                });
+            }
+        } catch (const cppxx::cli::parse_help &help) {
+            print_stderr(fmt::format("{}\n", help.what()));
+            return {};
+        } catch (const cppxx::cli::parse_error &e) {
+            return cppxx::unexpected_errorf("{}", e.what());
+        }
+
+        return cppxx::unexpected_errorf("{:?} is not served by the daemon", args[0]);
+    }
+
+    void serve(int fd) {
+        cppxx::defer _ = [fd]() { ::close(fd); };
+        auto session = std::make_shared<Session>(fd);
+
+        SocketReader reader(fd);
+        auto line = reader.line();
+        if (not line)
+            return;
+
+        Reply reply = {.done = true};
+        auto res = [&]() -> std::expected<void, std::runtime_error> {
+            auto request = rfl::json::read<Request>(*line);
+            if (not request)
+                return cppxx::unexpected_errorf("Invalid request: {}", request.error().what());
+            if (request->args.empty())
+                return cppxx::unexpected_errorf("Invalid request: no subcommand");
+            if (request->cwd != fs::current_path().string())
+                return cppxx::unexpected_errorf("The daemon serves {:?}, not {:?}", fs::current_path().string(), request->cwd);
+            if (request->env != environment()) {
+                reply.local = true;
+                return {};
+            }
+
+            set_thread_sink(std::make_shared<const Sink>([session](std::string_view text) {
+                session->send({.output = std::string(text)});
+            }));
+            cppxx::defer reset = []() { set_thread_sink(nullptr); };
+
+            spdlog::debug("serving {}", fmt::join(request->args, " "));
+            return handle(request->args, reply);
+        }();
+
+        if (not res)
+            reply.error = res.error().what();
+        session->send(reply);
+    }
+} // namespace
+
+std::optional<std::expected<void, std::runtime_error>> forward_to_daemon(const std::string &subcommand, int argc, char **argv) {
+    auto path = socket_path();
+    if (not path or not fs::exists(*path))
+        return std::nullopt;
+
+    // builds the daemon leaves to the client anyway, see handle()
+    if (subcommand == "build")
+        for (std::string_view arg : std::span(argv + 1, std::max(argc - 1, 0)))
+            for (std::string_view flag : {"--watch", "--trace", "--pgo"})
+                if (arg == flag or (arg.starts_with(flag) and arg[flag.size()] == '='))
+                    return std::nullopt;
+
+    // a stale socket of a daemon that is gone
+    const int fd = connect_to(*path);
+    if (fd < 0)
+        return std::nullopt;
+    cppxx::defer _ = [fd]() { ::close(fd); };
+
+    Request request = {.cwd = fs::current_path().string(), .args = {subcommand}, .env = environment()};
+    for (int i = 1; i < argc; ++i)
+        request.args.emplace_back(argv[i]);
+    if (not send_all(fd, rfl::json::write(request) + '\n'))
+        return std::nullopt;
+
+    SocketReader reader(fd);
+    for (auto line = reader.line(); line; line = reader.line()) {
+        auto reply = rfl::json::read<Reply>(*line);
+        if (not reply)
+            return cppxx::unexpected_errorf("Invalid reply from the daemon: {}", reply.error().what());
+        if (reply->output)
+            print_stderr(*reply->output);
+        if (not reply->done)
+            continue;
+
+        if (reply->error)
+            return cppxx::unexpected_errorf("{}", *reply->error);
+        if (reply->local) {
+            spdlog::info("the daemon leaves {:?} to this process, running it locally", subcommand);
+            return std::nullopt;
+        }
+        if (reply->exec) {
+            const std::string cmd = fmt::format("{}", fmt::join(*reply->exec, " "));
+            spdlog::info("running {:?}", cmd);
+            return system(cmd);
+        }
+        return std::expected<void, std::runtime_error>{};
+    }
+
+    return cppxx::unexpected_errorf("The daemon closed the connection before finishing {:?}", subcommand);
+}
+
+std::expected<void, std::runtime_error> Daemon::exec() {
+    auto path = socket_path();
+    if (not path)
+        return cppxx::unexpected_move(path);
+
+    if (const int fd = connect_to(*path); fd >= 0) {
+        ::close(fd);
+        return cppxx::unexpected_errorf("A daemon is already serving {:?} on {:?}", fs::current_path().string(), *path);
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(*path).parent_path(), ec);
+    ::unlink(path->c_str());
+
+    const int server = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0)
+        return cppxx::unexpected_errorf("Cannot create a socket: {}", std::strerror(errno));
+    cppxx::defer _ = [&]() {
+        ::close(server);
+        ::unlink(path->c_str());
+    };
+
+    const sockaddr_un addr = address_of(*path);
+    if (::bind(server, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0 or ::listen(server, SOMAXCONN) < 0)
+        return cppxx::unexpected_errorf("Cannot listen on {:?}: {}", *path, std::strerror(errno));
+
+    // a client that disconnects early must not take the daemon down
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int n = jobs.value_or(std::max<int>(std::thread::hardware_concurrency(), 1));
+    share_build_state(n);
+
+    // the log stays on the terminal of the daemon and goes to the client it belongs to as well
+    auto sink = std::make_shared<ClientSink>();
+    sink->set_pattern("[%l] %v");
+    spdlog::default_logger()->sinks().push_back(std::move(sink));
+
+    spdlog::info("serving {:?} on {:?} with {} jobs", fs::current_path().string(), *path, n);
+    for (;;) {
+        const int client = ::accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0 and (errno == EINTR or errno == ECONNABORTED))
+            continue;
+        if (client < 0)
+            return cppxx::unexpected_errorf("Cannot accept a client on {:?}: {}", *path, std::strerror(errno));
+
+        std::thread(serve, client).detach();
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <expected>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+
+// Hand `cppxx <subcommand> <args>` to the daemon serving the current directory, if one is running.
+// Returns nullopt if there is none, to run the subcommand locally instead
+std::optional<std::expected<void, std::runtime_error>> forward_to_daemon(const std::string &subcommand, int argc, char **argv);
@@ -0,0 +1,153 @@
+#include <fmt/ranges.h>
+#include <cppxx/error.h>
+#include <fstream>
+#include <sstream>
+#include "dependency_graph.h"
+
+namespace fs = std::filesystem;
+
+
+std::expected<std::vector<std::string>, std::runtime_error> DependencyGraph::parse_depfile(const std::string &path) {
+    std::ifstream is(path);
+    if (not is.is_open())
+        return cppxx::unexpected_errorf("Cannot open depfile {:?}", path);
+
+    std::stringstream ss;
+    ss << is.rdbuf();
+    const std::string content = ss.str();
+
+    // Tokenize "target: dep1 dep2 \<newline> dep3", honoring `\ ` and `$$` escapes
+    std::vector<std::string> tokens;
+    std::string token;
+    auto flush = [&]() {
+        if (not token.empty())
+            tokens.push_back(std::move(token));
+        token.clear();
+    };
+
+    for (size_t i = 0; i < content.size(); ++i) {
+        const char c = content[i];
+        if (c == '\\' and i + 1 < content.size() and content[i + 1] == '\n') {
+            flush();
+            ++i;
+        } else if (c == '\\' and i + 2 < content.size() and content[i + 1] == '\r' and content[i + 2] == '\n') {
+            flush();
+            i += 2;
+        } else if (c == '\\' and i + 1 < content.size() and (content[i + 1] == ' ' or content[i + 1] == '#')) {
+            token += content[++i];
+        } else if (c == '$' and i + 1 < content.size() and content[i + 1] == '$') {
+            token += content[++i];
+        } else if (c == ' ' or c == '\t' or c == '\r' or c == '\n') {
+            flush();
+        } else {
+            token += c;
+        }
+    }
+    flush();
+
+    // Everything up to and including the token ending in ':' is the target
+    auto colon = std::ranges::find_if(tokens, [](const std::string &t) { return t.ends_with(':'); });
+    if (colon == tokens.end())
+        return cppxx::unexpected_errorf("Malformed depfile {:?}: missing target", path);
+
+    return std::vector<std::string>(std::next(colon), tokens.end());
+}
+
+bool DependencyGraph::is_dirty(const CompileCommand &cc) {
+    const std::string object = cc.get_abs_path();
+    const auto entry = log.find(object);
+    if (not entry or entry->command_hash != BuildLog::hash(cc.command))
+        return true;
+
+    // an object that was deleted or replaced from outside is not the one recorded
+    std::error_code ec; // to avoid exceptions
+    if (auto time = fs::last_write_time(object, ec); ec or time.time_since_epoch().count() != entry->mtime)
+        return true;
+
+    bool touched = false;
+    int64_t newest = entry->mtime;
+    for (auto dep : entry->deps) {
+        auto dep_time = mtime(dep);
+        if (not dep_time)
+            return true;
+        if (*dep_time > entry->mtime)
+            touched = true;
+        newest = std::max(newest, *dep_time);
+    }
+
+    if (not touched)
+        return false;
+
+    std::vector<std::string> deps;
+    for (auto dep : entry->deps)
+        deps.push_back(log.path_of(dep));
+
+    if (inputs_hash(deps) != entry->inputs_hash)
+        return true;
+
+    // the object keeps matching its record
+    if (fs::last_write_time(object, fs::file_time_type(fs::file_time_type::duration(newest)), ec); ec)
+        return true;
+    log.touch(object, newest);
+    return false;
+}
+
+std::expected<void, std::runtime_error> DependencyGraph::update(const CompileCommand &cc, int64_t duration) {
+    const std::string object = cc.get_abs_path();
+    const std::string depfile = cc.get_dep_path();
+
+    std::error_code ec; // to avoid exceptions
+    const auto object_time = fs::last_write_time(object, ec);
+    if (ec)
+        return cppxx::unexpected_errorf("Cannot stat {:?}: {}", object, ec.message());
+
+    // Without a depfile the source itself is the only known prerequisite
+    auto deps = parse_depfile(depfile).value_or(std::vector{cc.file});
+    for (auto &dep : deps)
+        if (fs::path(dep).is_relative())
+            dep = (fs::path(cc.directory) / dep).lexically_normal().string();
+
+    log.record(object, BuildLog::hash(cc.command), object_time.time_since_epoch().count(), inputs_hash(deps).value_or(0),
+               duration, deps);
+    fs::remove(depfile, ec);
+
+    return {};
+}
+
+std::optional<int64_t> DependencyGraph::mtime(uint32_t id) {
+    if (auto it = mtimes.find(id); it != mtimes.end())
+        return it->second;
+
+    std::error_code ec;
+    auto time = fs::last_write_time(log.path_of(id), ec);
+    return mtimes.emplace(id, ec ? std::nullopt : std::optional<int64_t>(time.time_since_epoch().count())).first->second;
+}
+
+std::optional<uint64_t> DependencyGraph::content_hash(const std::string &path) {
+    {
+        std::lock_guard lock(hashes_mutex);
+        if (auto it = hashes.find(path); it != hashes.end())
+            return it->second;
+    }
+
+    std::optional<uint64_t> hash = std::nullopt;
+    if (std::ifstream is(path, std::ios::binary); is.is_open()) {
+        std::stringstream ss;
+        ss << is.rdbuf();
+        hash = BuildLog::hash(ss.str());
+    }
+
+    std::lock_guard lock(hashes_mutex);
+    return hashes.emplace(path, hash).first->second;
+}
+
+std::optional<uint64_t> DependencyGraph::inputs_hash(const std::vector<std::string> &deps) {
+    std::string combined;
+    for (const auto &dep : deps) {
+        auto hash = content_hash(dep);
+        if (not hash)
+            return std::nullopt;
+        combined += fmt::format("{}\n{:x}\n", dep, *hash);
+    }
+    return BuildLog::hash(combined);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <expected>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "compile_command.h"
+#include "build_log.h"
+
+
+// Decides which objects are out of date using the prerequisites stored in the build log.
+// Depfiles (emitted by `-MMD -MF`) are ingested into the log right after each compile and then removed,
+// so a no-op build never parses a depfile, and every prerequisite is stat'ed at most once. An object whose mtime differs
+// from the recorded one was deleted or replaced and is rebuilt.
+// When prerequisites were only touched (e.g. by switching git branches back and forth), their contents are hashed
+// and compared with the hashes recorded in the log before deciding to recompile, and the object is touched as well.
+class DependencyGraph {
+public:
+    explicit DependencyGraph(BuildLog &log)
+        : log(log) {}
+
+    bool is_dirty(const CompileCommand &cc);
+
+    // record a freshly compiled object, its prerequisites and how long it took (ms) into the build log
+    std::expected<void, std::runtime_error> update(const CompileCommand &cc, int64_t duration = 0);
+
+    static std::expected<std::vector<std::string>, std::runtime_error> parse_depfile(const std::string &path);
+
+private:
+    std::optional<int64_t> mtime(uint32_t id);
+    std::optional<uint64_t> content_hash(const std::string &path);
+    std::optional<uint64_t> inputs_hash(const std::vector<std::string> &deps);
+
+    BuildLog &log;
+    std::unordered_map<uint32_t, std::optional<int64_t>> mtimes;
+    std::unordered_map<std::string, std::optional<uint64_t>> hashes;
+    std::mutex hashes_mutex;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <fmt/ranges.h>
+#include <cppxx/error.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Expands `${NAME}` and `${NAME:-default}` in a single left to right scan, defaults may contain references themselves.
+// A name is looked up in `vars` first, then in the environment. Vars may reference each other in any order: each one
+// is expanded on first use and memoized, and a chain of references that leads back to itself is reported as a cycle.
+// A var that references its own name refers to the environment variable, e.g. `PATH = "${PATH}:/opt/bin"`
+class Expander {
+public:
+    explicit Expander(const std::unordered_map<std::string, std::string> &vars)
+        : vars(vars) {}
+
+    std::string expand(std::string_view input) {
+        std::string result;
+        result.reserve(input.size());
+
+        for (size_t pos = 0; pos < input.size();) {
+            const size_t start = input.find("${", pos);
+            result.append(input.substr(pos, start - pos));
+            if (start == std::string_view::npos)
+                break;
+
+            size_t i = start + 2;
+            while (i < input.size() and (std::isalnum(uint8_t(input[i])) or input[i] == '_'))
+                ++i;
+            const std::string_view name = input.substr(start + 2, i - start - 2);
+            if (name.empty() or std::isdigit(uint8_t(name[0])))
+                throw cppxx::errorf("Failed to resolve {:?}: invalid variable name at position {}", input, start);
+
+            // the default runs up to the matching brace
+            std::optional<std::string_view> fallback;
+            if (input.substr(i, 2) == ":-") {
+                size_t depth = 0, j = i + 2;
+                for (; j < input.size() and (depth > 0 or input[j] != '}'); ++j) {
+                    if (input.substr(j, 2) == "${") {
+                        ++depth;
+                        ++j;
+                    } else if (input[j] == '}') {
+                        --depth;
+                    }
+                }
+                fallback = input.substr(i + 2, j - i - 2);
+                i = j;
+            }
+            if (i >= input.size() or input[i] != '}')
+                throw cppxx::errorf("Failed to resolve {:?}: missing `}}` for `${{{}`", input, name);
+
+            if (auto value = lookup(std::string(name)))
+                result += *value;
+            else if (fallback)
+                result += expand(*fallback);
+            else
+                throw cppxx::errorf("Failed to resolve {:?}: variable `${{{}}}` is not set and no fallback provided. vars = {}",
+                                    input, name, vars);
+
+            pos = i + 1;
+        }
+
+        return result;
+    }
+
+    // every var expanded, in the same shape as the input
+    std::unordered_map<std::string, std::string> resolve_all() {
+        std::unordered_map<std::string, std::string> result;
+        for (const auto &[name, _] : vars)
+            result.emplace(name, *lookup(name));
+        return result;
+    }
+
+private:
+    std::optional<std::string> lookup(const std::string &name) {
+        if (auto it = resolved.find(name); it != resolved.end())
+            return it->second;
+
+        auto var = vars.find(name);
+        const bool self_reference = not resolving.empty() and resolving.back() == name;
+        if (var == vars.end() or self_reference) {
+            auto it = env.find(name);
+            if (it == env.end()) {
+                const char *value = std::getenv(name.c_str());
+                it = env.emplace(name, value ? std::optional<std::string>(value) : std::nullopt).first;
+            }
+            return it->second;
+        }
+
+        if (std::ranges::find(resolving, name) != resolving.end())
+            throw cppxx::errorf("Cyclic reference in vars: {} -> {}", fmt::join(resolving, " -> "), name);
+
+        resolving.push_back(name);
+        std::string value = expand(var->second);
+        resolving.pop_back();
+
+        return resolved.emplace(name, std::move(value)).first->second;
+    }
+
+    const std::unordered_map<std::string, std::string> &vars;
+    std::unordered_map<std::string, std::string> resolved;
+    std::unordered_map<std::string, std::optional<std::string>> env;
+    std::vector<std::string> resolving; // the chain of vars being expanded, to detect cycles
+};
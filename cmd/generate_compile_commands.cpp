@@ -4,7 +4,10 @@
 #include <cppxx/match.h>
 #include <rfl/json.hpp>
 #include <sha256.h>
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <unistd.h>
 #include "workspace.h"
 #include "options.h"
 
@@ -52,8 +55,116 @@ find_target(const Workspace &w, const std::string &name, bool is_dep = false) {
     return cppxx::unexpected_errorf("Target {:?} is not found", name);
 };
 
+// Generated sources are named after their content and only written if missing, so their mtime stays put
+static std::expected<void, std::runtime_error> write_generated(const fs::path &path, const std::string &content) {
+    std::error_code ec;
+    if (fs::exists(path, ec))
+        return {};
+
+    const fs::path tmp = path.string() + fmt::format(".tmp-{}", ::getpid());
+    fs::create_directories(path.parent_path(), ec);
+    if (std::ofstream os(tmp); not (os << content))
+        return cppxx::unexpected_errorf("Cannot write {:?}", tmp.string());
+    if (fs::rename(tmp, path, ec); ec)
+        return cppxx::unexpected_errorf("Cannot write {:?}: {}", path.string(), ec.message());
+    return {};
+}
+
+// Batches of sources for a unity build. A batch ends after a source whose path hashes to 0 modulo `batch`, or once it
+// has grown to twice that size, so the grouping is the same on every run and adding or removing a source only changes
+// the batch it belongs to instead of shifting every batch after it
+static std::vector<std::vector<std::string>> unity_batches(std::vector<std::string> sources, size_t batch) {
+    std::ranges::sort(sources);
+
+    std::vector<std::vector<std::string>> batches(1);
+    for (auto &source : sources) {
+        const bool boundary = std::stoul(SHA256::hashString(source).substr(0, 8), nullptr, 16) % batch == 0;
+        batches.back().push_back(std::move(source));
+        if (boundary or batches.back().size() >= 2 * batch)
+            batches.emplace_back();
+    }
+
+    if (batches.back().empty())
+        batches.pop_back();
+    return batches;
+}
+
+// Replace the sources of every batch by a generated file including them, the depfile of its object tracks every member
+static std::expected<std::vector<std::string>, std::runtime_error>
+unity_sources(const std::vector<std::string> &sources, size_t batch, const std::string &command_hash) {
+    // C and C++ sources cannot share a translation unit
+    std::vector<std::string> c, cpp, result;
+    for (const auto &source : sources)
+        (fs::path(source).extension() == ".c" ? c : cpp).push_back(source);
+
+    const fs::path dir = fs::path(std::getenv(CPPXX_CACHE)) / "build" / "unity";
+    for (auto [language, extension] : {std::pair{&c, ".c"}, std::pair{&cpp, ".cpp"}}) {
+        for (auto &members : unity_batches(std::move(*language), batch)) {
+            if (members.size() == 1) {
+                result.push_back(std::move(members.front()));
+                continue;
+            }
+
+            std::string content = "// generated by cppxx, do not edit\n";
+            for (const auto &member : members)
+                content += fmt::format("#include {:?}\n", fs::absolute(member).lexically_normal().string());
+
+            const fs::path path = dir / fmt::format("{}-{}{}", command_hash, SHA256::hashString(content).substr(0, 8), extension);
+            if (auto res = write_generated(path, content); not res)
+                return cppxx::unexpected_move(res);
+            result.push_back(path.string());
+        }
+    }
+
+    return result;
+}
+
+// The prefix header including the `pch` headers of a target. Like the objects, it is named after the compile command,
+// so targets sharing their flags and headers share the precompiled header as well
+static std::expected<std::string, std::runtime_error>
+prefix_header(const std::vector<std::string> &headers, const std::string &command_hash) {
+    std::string content = "// generated by cppxx, do not edit\n";
+    for (const auto &header : headers)
+        content += fmt::format("#include <{}>\n", header);
+
+    const fs::path path = fs::path(std::getenv(CPPXX_CACHE)) / "build" / "pch"
+        / fmt::format("{}-{}.h", command_hash, SHA256::hashString(content).substr(0, 8));
+    return write_generated(path, content).transform([&]() { return path.string(); });
+}
+
+// How a target is linked, its own `linker` and `lto` take precedence over the ones of the workspace
+static std::expected<Linking, std::runtime_error> linking_of(const Workspace &w, const Target &t) {
+    Linking linking = {
+        .driver = w.compiler.empty() ? "c++" : w.compiler,
+        .linker = t.linker.value_or(w.linker.value_or("")),
+        .lto = t.lto.value_or(w.lto.value_or("")),
+    };
+
+    constexpr std::string_view linkers[] = {"", "mold", "lld", "gold", "bfd"}, ltos[] = {"", "full", "thin"};
+    if (std::ranges::find(linkers, linking.linker) == std::end(linkers))
+        return cppxx::unexpected_errorf("Unknown linker {:?}, expected one of mold, lld, gold or bfd", linking.linker);
+    if (std::ranges::find(ltos, linking.lto) == std::end(ltos))
+        return cppxx::unexpected_errorf("Unknown lto mode {:?}, expected full or thin", linking.lto);
+    return linking;
+}
+
+// The linker, the LTO mode and for ThinLTO a cache under $CPPXX_CACHE, so that relinking only redoes the code
+// generation of the modules that changed. GCC has no ThinLTO, its default LTO partitions the program already
+static std::vector<std::string> link_flags_of(const Linking &l) {
+    std::vector<std::string> flags;
+    if (not l.linker.empty())
+        flags.push_back(fmt::format("-fuse-ld={}", l.linker));
+    if (not l.lto.empty())
+        flags.push_back(l.clang() and l.lto == "thin" ? "-flto=thin" : "-flto");
+    if (l.clang() and l.lto == "thin") {
+        const std::string dir = (fs::path(std::getenv(CPPXX_CACHE)) / "lto").string();
+        flags.push_back(l.linker == "lld" ? fmt::format("-Wl,--thinlto-cache-dir={}", dir) : fmt::format("-Wl,-plugin-opt,cache-dir={}", dir));
+    }
+    return flags;
+}
+
 static std::expected<CompileCommands, std::runtime_error>
-generate_compile_commands_for_target(const Workspace &w, RefTarget target) {
+generate_compile_commands_for_target(const Workspace &w, RefTarget target, bool for_build) {
     // TODO: c?
     const std::string compiler_standard = "-std=c++"
         + (std::holds_alternative<int>(w.standard) ? std::to_string(std::get<int>(w.standard))
@@ -86,35 +197,148 @@ generate_compile_commands_for_target(const Workspace &w, RefTarget target) {
         return {};
     };
 
-    return collect(target).transform([&]() -> CompileCommands {
-        if (auto &srcs = *target.get().sources; target.get().sources) {
-            return {
+    // objects of a shared library must be position independent
+    if (target.get().dynamic.value_or(false))
+        if (auto [it, ok] = flags_set.emplace("-fPIC"); ok)
+            flags.push_back(*it);
+
+    auto linking = linking_of(w, target);
+    if (not linking)
+        return cppxx::unexpected_move(linking);
+    if (not linking->lto.empty())
+        if (auto [it, ok] = flags_set.emplace(linking->clang() and linking->lto == "thin" ? "-flto=thin" : "-flto"); ok)
+            flags.push_back(*it);
+
+    // GCC needs modules enabled explicitly, and its depfiles must not carry the module rules meant for make
+    const bool clang = linking->clang();
+    const bool modules = target.get().modules.value_or(false);
+    if (modules and not clang)
+        for (std::string flag : {"-fmodules-ts", "-Mno-modules"})
+            if (auto [it, ok] = flags_set.emplace(std::move(flag)); ok)
+                flags.push_back(*it);
+
+    return collect(target).and_then([&]() -> std::expected<CompileCommands, std::runtime_error> {
+        if (target.get().sources) {
+            // shared by every source of this target, so only hash it once
+            const std::string command = fmt::format("{} {}", w.compiler, fmt::join(flags, " "));
+            const std::string command_hash = SHA256::hashString(command).substr(0, 8);
+            const std::string directory = fs::path(std::getenv(CPPXX_CACHE)) / "build";
+
+            std::vector<std::string> srcs = *target.get().sources;
+            // a module declaration has to come first in its unit, which rules out batching and a prefix header
+            if (const auto &t = target.get(); for_build and not modules and (t.unity.value_or(false) or t.unity_batch)) {
+                auto batched = unity_sources(srcs, std::max(t.unity_batch.value_or(8), 1), command_hash);
+                if (not batched)
+                    return cppxx::unexpected_move(batched);
+                srcs = std::move(*batched);
+            }
+
+            // the header is precompiled once by a node of its own, clang needs to be pointed at the result explicitly
+            std::string pch, include;
+            std::vector<CompileCommand> pchs;
+            if (const auto &headers = target.get().pch; headers and not headers->empty() and not modules) {
+                auto header = prefix_header(*headers, command_hash);
+                if (not header)
+                    return cppxx::unexpected_move(header);
+                pch = std::move(*header);
+                include = fmt::format(" -include {}", pch);
+
+                if (for_build) {
+                    CompileCommand cc = {};
+                    cc.file = pch;
+                    cc.directory = directory;
+                    cc.base_command = command;
+                    cc.output = clang ? fs::path(pch).replace_extension(".pch").string() : pch + ".gch";
+                    cc.command = fmt::format("{} -x c++-header -MMD -MF {} -o {} -c {}", command, cc.get_dep_path(), cc.output, cc.file);
+                    if (clang)
+                        include = fmt::format(" -include-pch {}", cc.output);
+                    pchs.push_back(std::move(cc));
+                }
+            }
+
+            return CompileCommands{
                 .ccs = srcs | cppxx::map([&](const fs::path &file) {
-                           const std::string command = fmt::format("{} {}", w.compiler, fmt::join(flags, " "));
+                           // a C++ header cannot be used by C sources, nor can C sources be modules
+                           const bool cpp = file.extension() != ".c";
+
                            CompileCommand cc = {};
                            cc.file = file;
-                           cc.directory = fs::path(std::getenv(CPPXX_CACHE)) / "build";
-                           cc.output = fmt::format("{}{}-{}.o", SHA256::hashString(command).substr(0, 8),
-                                                   SHA256::hashString(file).substr(0, 8), file.filename().string());
-                           cc.command = fmt::format("{} -o {} -c {}", command, cc.output, cc.file);
+                           cc.directory = directory;
+                           cc.base_command = command;
+                           cc.output = fmt::format("{}{}-{}.o", command_hash, SHA256::hashString(file).substr(0, 8),
+                                                   file.filename().string());
+
+                           // the module map is written once the sources have been scanned
+                           std::string extra;
+                           if (cpp and not pch.empty()) {
+                               cc.pch = pch;
+                               extra = include;
+                           } else if (cpp and modules) {
+                               cc.modules = (fs::path(directory) / cc.output).replace_extension(".modmap").string();
+                               extra = clang ? fmt::format(" @{}", cc.modules()) : fmt::format(" -fmodule-mapper={}", cc.modules());
+                           }
+                           cc.command = fmt::format("{}{} -MMD -MF {} -o {} -c {}", command, extra,
+                                                    fs::path(cc.output).replace_extension(".d").string(), cc.output, cc.file);
 
                            return cc;
                        })
                     | cppxx::collect<std::vector>(),
                 .link_flags = std::move(link_flags),
+                .pchs = std::move(pchs),
+                .linking = std::move(*linking),
             };
         } else {
-            return {};
+            return CompileCommands{.ccs = {}, .link_flags = {}, .linking = std::move(*linking)};
         }
     });
 }
 
-std::expected<CompileCommands, std::runtime_error> generate_compile_commands(const Workspace &w, const std::string &target_name) {
+// Reverse post-order of the dependency graph: every target comes before the targets it depends on,
+// which is the order a static linker needs its archives in
+static std::vector<std::string> link_order(const Workspace &w, const std::string &target_name) {
+    std::vector<std::string> order;
+    std::unordered_set<std::string> visited;
+
+    std::function<void(const std::string &)> visit = [&](const std::string &name) {
+        if (not visited.emplace(name).second)
+            return;
+        if (auto t = find_target(w, name); t)
+            for (auto &dep : flatten_variant(t->get().depends_on, true))
+                visit(dep);
+        order.push_back(name);
+    };
+
+    visit(target_name);
+    std::ranges::reverse(order);
+    return order;
+}
+
+// Archives are named after the objects they contain, so consumers with identical flags share one archive
+static Archive make_archive(const Workspace &w, const std::string &name, const CompileCommands &ccs) {
+    const bool dynamic = find_target(w, name).transform([](RefTarget t) { return t.get().dynamic.value_or(false); }).value_or(false);
+
+    Archive archive = {.name = name, .output = "", .objects = {}, .dynamic = dynamic, .linking = ccs.linking};
+    for (const auto &cc : ccs.ccs)
+        archive.objects.push_back(cc.get_abs_path());
+    if (dynamic) {
+        archive.link_flags.assign(ccs.link_flags.begin(), ccs.link_flags.end());
+        std::ranges::move(link_flags_of(ccs.linking), std::back_inserter(archive.link_flags));
+    }
+
+    const std::string key = fmt::format("{}\n{}\n{}", fmt::join(archive.objects, "\n"), fmt::join(archive.link_flags, " "), dynamic);
+    archive.output = (fs::path(std::getenv(CPPXX_CACHE)) / "build" / "lib"
+                      / fmt::format("lib{}-{}.{}", name, SHA256::hashString(key).substr(0, 8), dynamic ? "so" : "a"))
+                         .string();
+    return archive;
+}
+
+std::expected<CompileCommands, std::runtime_error>
+generate_compile_commands(const Workspace &w, const std::string &target_name, bool for_build) {
     std::unordered_map<std::string, CompileCommands> targets;
 
     auto add_target = [&](const std::string &name) {
         return [&](RefTarget t) {
-            return generate_compile_commands_for_target(w, t).transform([&](CompileCommands &&cc) {
+            return generate_compile_commands_for_target(w, t, for_build).transform([&](CompileCommands &&cc) {
                 targets.emplace(name, std::move(cc));
                 return t;
             });
@@ -137,9 +361,19 @@ std::expected<CompileCommands, std::runtime_error> generate_compile_commands(con
         .and_then(add_target(target_name))
         .and_then(collect)
         .transform([&]() {
-            CompileCommands res;
-            for (auto &[_, ccs] : targets) {
+            CompileCommands res = {.ccs = {}, .link_flags = {}, .linking = targets.at(target_name).linking};
+            for (auto &flag : link_flags_of(res.linking))
+                res.link_flags.insert(std::move(flag));
+
+            for (auto &name : link_order(w, target_name)) {
+                auto &ccs = targets.at(name);
+                const bool is_lib = name != target_name and w.lib and w.lib->contains(name);
+
+                if (is_lib and not ccs.ccs.empty())
+                    res.archives.push_back(make_archive(w, name, ccs));
+
                 std::ranges::move(ccs.ccs, std::back_inserter(res.ccs));
+                std::ranges::move(ccs.pchs, std::back_inserter(res.pchs));
                 res.link_flags.merge(ccs.link_flags);
             }
             return res;
@@ -150,12 +384,17 @@ std::expected<CompileCommands, std::runtime_error> generate_compile_commands(con
 }
 
 std::expected<void, std::runtime_error> GenerateCompileCommands::exec() {
-    return Workspace::New(root.value_or(""))
-        .and_then(resolve_vars)
-        .and_then([&](Workspace &&w) { return resolve_target(std::move(w), target); })
-        .and_then(resolve_remotes)
-        .and_then(resolve_paths)
-        .and_then([&](Workspace &&w) { return generate_compile_commands(w, target); })
+    auto resolve = [&]() {
+        return Workspace::New(root.value_or(""))
+            .and_then(resolve_vars)
+            .and_then([&](Workspace &&w) { return resolve_target(std::move(w), target); })
+            .and_then(resolve_remotes)
+            .and_then(resolve_paths);
+    };
+
+    // editors run this on every save, so the resolved workspace is reused while the config is unchanged
+    return resolve_cached(root.value_or(""), target, resolve)
+        .and_then([&](Workspace &&w) { return generate_compile_commands(w, target, false); })
         .transform([](const CompileCommands &ccs) {
             auto j = rfl::json::write(ccs.ccs, YYJSON_WRITE_PRETTY_TWO_SPACES);
             fmt::println("{}", j);
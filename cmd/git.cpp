@@ -60,16 +60,16 @@ std::expected<std::string, std::runtime_error> Git::clone(const std::string &cac
     const std::string host = extract_host_and_path(url);
 
     fs::path result_path = fs::path(cache) / host / tag;
-    if (fs::exists(result_path)) {
-        // TODO: check if the result_path is dirty or needs update
-        return result_path;
-    }
 
-    spdlog::info("cloning {}@{}", host, tag);
-    const std::string cmd = fmt::format("git -c advice.detachedHead=false clone --quiet --depth 1 --branch '{}' '{}' '{}'", tag,
-                                        url, result_path.string());
+    // TODO: check if the result_path is dirty or needs update
+    auto res = populate_once(result_path.string(), [&](const std::string &tmp) -> std::expected<void, std::runtime_error> {
+        spdlog::info("cloning {}@{}", host, tag);
+        const std::string cmd =
+            fmt::format("git -c advice.detachedHead=false clone --quiet --depth 1 --branch '{}' '{}' '{}'", tag, url, tmp);
+        return system(cmd);
+    });
 
-    if (auto res = system(cmd); not res)
+    if (not res)
         return cppxx::unexpected_errorf("Failed to clone repo from {:?}, {}", url, res.error().what());
 
     return result_path;
@@ -0,0 +1,273 @@
+#include <fmt/ranges.h>
+#include <cppxx/error.h>
+#include <algorithm>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "glob.h"
+
+
+static bool is_literal(std::string_view segment) { return segment.find_first_of("*?[\\") == std::string_view::npos; }
+
+// `[...]` at `p[i]`, returns the index past the closing bracket, or npos if it is not a valid class
+static size_t match_class(std::string_view p, size_t i, char c, bool &matched) {
+    size_t j = i + 1;
+    const bool negate = j < p.size() and (p[j] == '!' or p[j] == '^');
+    if (negate)
+        ++j;
+
+    matched = false;
+    for (bool first = true; j < p.size() and (first or p[j] != ']'); first = false) {
+        char lo = p[j], hi = p[j];
+        if (j + 2 < p.size() and p[j + 1] == '-' and p[j + 2] != ']') {
+            hi = p[j + 2];
+            j += 3;
+        } else {
+            j += 1;
+        }
+        matched = matched or (lo <= c and c <= hi);
+    }
+
+    if (j >= p.size())
+        return std::string_view::npos;
+    matched = matched != negate;
+    return j + 1;
+}
+
+bool Glob::match(std::string_view p, std::string_view s) {
+    // iterative wildcard matching, backtracking only to the last `*`
+    size_t pi = 0, si = 0, star = std::string_view::npos, mark = 0;
+    while (si < s.size()) {
+        if (pi < p.size()) {
+            if (p[pi] == '*') {
+                star = pi++;
+                mark = si;
+                continue;
+            }
+
+            bool matched = false;
+            size_t next = pi + 1;
+            if (p[pi] == '?') {
+                matched = true;
+            } else if (p[pi] == '[') {
+                if (size_t end = match_class(p, pi, s[si], matched); end != std::string_view::npos)
+                    next = end;
+                else
+                    matched = s[si] == '[';
+            } else if (p[pi] == '\\' and pi + 1 < p.size()) {
+                matched = p[pi + 1] == s[si];
+                next = pi + 2;
+            } else {
+                matched = p[pi] == s[si];
+            }
+
+            if (matched) {
+                pi = next;
+                ++si;
+                continue;
+            }
+        }
+
+        if (star == std::string_view::npos)
+            return false;
+        pi = star + 1;
+        si = ++mark;
+    }
+
+    while (pi < p.size() and p[pi] == '*')
+        ++pi;
+    return pi == p.size();
+}
+
+std::vector<std::string> Glob::expand_braces(const std::string &pattern) {
+    // the first `{...}` group that has a top level comma
+    for (size_t open = pattern.find('{'); open != std::string::npos; open = pattern.find('{', open + 1)) {
+        std::vector<size_t> commas;
+        size_t close = std::string::npos;
+        for (size_t i = open + 1, depth = 0; i < pattern.size() and close == std::string::npos; ++i) {
+            if (pattern[i] == '{')
+                ++depth;
+            else if (pattern[i] == '}' and depth > 0)
+                --depth;
+            else if (pattern[i] == '}')
+                close = i;
+            else if (pattern[i] == ',' and depth == 0)
+                commas.push_back(i);
+        }
+
+        if (close == std::string::npos or commas.empty())
+            continue;
+
+        std::vector<std::string> result;
+        commas.push_back(close);
+        for (size_t start = open + 1; auto comma : commas) {
+            auto expanded = expand_braces(pattern.substr(0, open) + pattern.substr(start, comma - start) + pattern.substr(close + 1));
+            std::ranges::move(expanded, std::back_inserter(result));
+            start = comma + 1;
+        }
+        return result;
+    }
+
+    return {pattern};
+}
+
+const std::vector<Glob::Entry> &Glob::list(const std::string &dir) {
+    if (auto it = listings.find(dir); it != listings.end())
+        return it->second;
+
+    std::vector<Entry> entries;
+    if (DIR *d = ::opendir(dir.c_str()); d) {
+        // d_type saves a stat per entry, only symlinks and file systems without it need one
+        for (dirent *e; (e = ::readdir(d));) {
+            std::string_view name = e->d_name;
+            if (name == "." or name == "..")
+                continue;
+
+            Entry entry = {.name = std::string(name), .is_dir = e->d_type == DT_DIR, .is_file = e->d_type == DT_REG};
+            if (e->d_type == DT_LNK or e->d_type == DT_UNKNOWN) {
+                struct stat st;
+                if (::fstatat(::dirfd(d), e->d_name, &st, 0) == 0) {
+                    entry.is_dir = S_ISDIR(st.st_mode);
+                    entry.is_file = S_ISREG(st.st_mode);
+                }
+                entry.is_link = e->d_type == DT_LNK
+                    or (e->d_type == DT_UNKNOWN and ::fstatat(::dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0
+                        and S_ISLNK(st.st_mode));
+            }
+            entries.push_back(std::move(entry));
+        }
+        ::closedir(d);
+    }
+
+    std::ranges::sort(entries, {}, &Entry::name);
+    return listings.emplace(dir, std::move(entries)).first->second;
+}
+
+std::vector<std::string> Glob::directories() const {
+    std::vector<std::string> dirs;
+    for (const auto &[dir, _] : listings)
+        dirs.push_back(dir);
+    std::ranges::sort(dirs);
+    return dirs;
+}
+
+void Glob::walk(const std::vector<std::string> &segments, size_t i, const std::string &dir, std::vector<std::string> &out) {
+    const std::string &segment = segments[i];
+    const bool last = i + 1 == segments.size();
+    auto join = [&](const std::string &name) { return dir.ends_with('/') ? dir + name : dir + '/' + name; };
+
+    if (segment == "**") {
+        // zero directories, then one more level; symlinked directories are not followed to avoid cycles
+        if (not last)
+            walk(segments, i + 1, dir, out);
+        for (const auto &e : list(dir)) {
+            if (e.name.starts_with('.'))
+                continue;
+            if (last and e.is_file)
+                out.push_back(join(e.name));
+            if (e.is_dir and not e.is_link)
+                walk(segments, i, join(e.name), out);
+        }
+        return;
+    }
+
+    if (is_literal(segment)) {
+        if (not last)
+            return walk(segments, i + 1, join(segment), out);
+
+        for (const auto &e : list(dir))
+            if (e.is_file and e.name == segment)
+                out.push_back(join(e.name));
+        return;
+    }
+
+    for (const auto &e : list(dir)) {
+        if (e.name.starts_with('.') and not segment.starts_with('.'))
+            continue;
+        if (not match(segment, e.name))
+            continue;
+        if (last and e.is_file)
+            out.push_back(join(e.name));
+        else if (not last and e.is_dir)
+            walk(segments, i + 1, join(e.name), out);
+    }
+}
+
+// split into segments, `a**b` becomes `**` followed by `a*b`
+static std::vector<std::string> segments_of(const std::string &pattern) {
+    std::vector<std::string> segments;
+    for (size_t start = 0; start <= pattern.size();) {
+        const size_t end = std::min(pattern.find('/', start), pattern.size());
+        std::string segment = pattern.substr(start, end - start);
+        start = end + 1;
+
+        if (segment.empty() or segment == ".")
+            continue;
+        if (segment != "**" and segment.find("**") != std::string::npos) {
+            segments.emplace_back("**");
+            while (segment.find("**") != std::string::npos)
+                segment.replace(segment.find("**"), 2, "*");
+        }
+        segments.push_back(std::move(segment));
+    }
+    return segments;
+}
+
+// the longest literal prefix of `segments`, where the walk starts, and the index of the first segment after it
+static std::pair<std::string, size_t> base_of(const std::string &pattern, const std::vector<std::string> &segments) {
+    std::string base = pattern.starts_with('/') ? "/" : ".";
+    size_t i = 0;
+    for (; i + 1 < segments.size() and is_literal(segments[i]); ++i)
+        base = base == "." ? segments[i] : base == "/" ? base + segments[i] : base + '/' + segments[i];
+    return {base, i};
+}
+
+std::vector<std::string> Glob::expand(const std::string &pattern) {
+    std::vector<std::string> result;
+    std::unordered_set<std::string> seen;
+
+    for (const auto &alternative : expand_braces(pattern)) {
+        const auto segments = segments_of(alternative);
+        if (segments.empty())
+            continue;
+
+        const auto [base, i] = base_of(alternative, segments);
+        std::vector<std::string> matched;
+        walk(segments, i, base, matched);
+        for (auto &path : matched)
+            if (seen.insert(path).second)
+                result.push_back(std::move(path));
+    }
+
+    return result;
+}
+
+std::expected<std::vector<std::string>, std::runtime_error> Glob::expand(const std::vector<std::string> &patterns) {
+    // whether the directory a walk starts from exists for at least one alternative
+    auto has_base = [](const std::string &pattern) {
+        for (const auto &alternative : expand_braces(pattern)) {
+            const auto segments = segments_of(alternative);
+            struct stat st;
+            if (segments.empty() or (::stat(base_of(alternative, segments).first.c_str(), &st) == 0 and S_ISDIR(st.st_mode)))
+                return true;
+        }
+        return false;
+    };
+
+    std::vector<std::string> collected;
+    for (const auto &pattern : patterns) {
+        if (pattern.starts_with('!')) {
+            auto excluded = expand(pattern.substr(1));
+            std::unordered_set<std::string> set(excluded.begin(), excluded.end());
+            std::erase_if(collected, [&](const std::string &p) { return set.contains(p); });
+            continue;
+        }
+
+        auto matched = expand(pattern);
+        if (matched.empty() and not has_base(pattern))
+            return cppxx::unexpected_errorf("The directory of {:?} does not exist", pattern);
+        std::ranges::move(matched, std::back_inserter(collected));
+    }
+    return collected;
+}
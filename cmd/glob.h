@@ -0,0 +1,43 @@
+#pragma once
+
+#include <expected>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Shell-like globbing for `sources`:
+// - `*`, `?` and `[a-z]`/`[!a-z]` match within a path segment, names starting with a dot are only matched explicitly
+// - `**` as a segment matches any number of directories, and `src/**.cpp` is the same as `src/**/*.cpp`
+// - `{a,b}` alternatives are expanded first and may be nested
+// - `!pattern` in a list of patterns excludes what it matches
+// Directory listings are read once with readdir and kept for the lifetime of the Glob, so the overlapping patterns
+// of many targets are matched without hitting the file system again
+class Glob {
+public:
+    // regular files matching `pattern`, without duplicates and sorted within each directory
+    std::vector<std::string> expand(const std::string &pattern);
+
+    // the files of `patterns` in order, a pattern prefixed with `!` removes the files matched by the patterns before it.
+    // A pattern without matches is fine, one whose directory does not exist is most likely a typo and an error
+    std::expected<std::vector<std::string>, std::runtime_error> expand(const std::vector<std::string> &patterns);
+
+    // every directory that was read, their mtimes tell whether an expansion is still valid
+    std::vector<std::string> directories() const;
+
+    static std::vector<std::string> expand_braces(const std::string &pattern);
+    static bool match(std::string_view pattern, std::string_view name);
+
+private:
+    struct Entry {
+        std::string name;
+        bool is_dir = false, is_file = false, is_link = false;
+    };
+
+    const std::vector<Entry> &list(const std::string &dir);
+    void walk(const std::vector<std::string> &segments, size_t i, const std::string &dir, std::vector<std::string> &out);
+
+    std::unordered_map<std::string, std::vector<Entry>> listings;
+};
@@ -0,0 +1,112 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <cppxx/error.h>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "jobserver.h"
+
+
+// the value of the last `--jobserver-auth=` (make >= 4.2) or `--jobserver-fds=` (older) in MAKEFLAGS
+static std::string_view find_auth(std::string_view makeflags) {
+    for (std::string_view key : {"--jobserver-auth=", "--jobserver-fds="}) {
+        if (auto pos = makeflags.rfind(key); pos != std::string_view::npos) {
+            auto value = makeflags.substr(pos + key.size());
+            return value.substr(0, value.find(' '));
+        }
+    }
+    return {};
+}
+
+static bool parse_fd(std::string_view str, int &fd) {
+    auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), fd);
+    return ec == std::errc() and ptr == str.data() + str.size() and fd >= 0 and ::fcntl(fd, F_GETFD) != -1;
+}
+
+std::expected<Jobserver, std::runtime_error> Jobserver::from_env(int jobs) {
+    const char *makeflags = std::getenv("MAKEFLAGS");
+    const auto auth = find_auth(makeflags ? makeflags : "");
+
+    if (auth.starts_with("fifo:")) {
+        const std::string path(auth.substr(5));
+        if (int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC); fd >= 0)
+            return Jobserver(fd, fd, false, true);
+
+        spdlog::warn("jobserver fifo {:?} is unavailable: {}", path, std::strerror(errno));
+    } else if (auto comma = auth.find(','); comma != std::string_view::npos) {
+        int read_fd = -1, write_fd = -1;
+        if (parse_fd(auth.substr(0, comma), read_fd) and parse_fd(auth.substr(comma + 1), write_fd))
+            return Jobserver(read_fd, write_fd, false, false);
+
+        // make closes the descriptors for recipes that are not marked with `+`
+        spdlog::warn("jobserver {:?} is unavailable, prefix the make rule with '+'", auth);
+    }
+
+    // not inheriting CLOEXEC on purpose, the children need the descriptors
+    int fds[2];
+    if (::pipe(fds) < 0)
+        return cppxx::unexpected_errorf("Failed to create the jobserver pipe: {}", std::strerror(errno));
+
+    Jobserver server(fds[0], fds[1], true, true);
+    for (int i = 1; i < jobs; ++i)
+        server.release('+');
+
+    const auto flags = fmt::format("-j{} --jobserver-auth={},{}", jobs, fds[0], fds[1]);
+    ::setenv("MAKEFLAGS", flags.c_str(), 1);
+
+    return server;
+}
+
+Jobserver::Jobserver(Jobserver &&other) noexcept
+    : read_fd(std::exchange(other.read_fd, -1))
+    , write_fd(std::exchange(other.write_fd, -1))
+    , server(other.server)
+    , owned(std::exchange(other.owned, false))
+    , implicit(other.implicit.load()) {}
+
+Jobserver::~Jobserver() {
+    if (not owned)
+        return;
+    if (read_fd >= 0)
+        ::close(read_fd);
+    if (write_fd >= 0 and write_fd != read_fd)
+        ::close(write_fd);
+}
+
+std::expected<char, std::runtime_error> Jobserver::acquire(std::stop_token stop) {
+    // the pipe may be shared in non-blocking mode by the parent, so wait for it to become readable first.
+    // Tokens only come back when other jobs finish, a cancelled build checks for the stop in between
+    pollfd pfd = {.fd = read_fd, .events = POLLIN, .revents = 0};
+    const int timeout = stop.stop_possible() ? 100 : -1;
+    for (char token;;) {
+        if (stop.stop_requested())
+            return cppxx::unexpected_errorf("Waiting for a jobserver token was cancelled");
+
+        const int ready = ::poll(&pfd, 1, timeout);
+        if (ready < 0 and errno != EINTR)
+            return cppxx::unexpected_errorf("Failed to wait for a jobserver token: {}", std::strerror(errno));
+        if (ready <= 0)
+            continue;
+
+        if (ssize_t n = ::read(read_fd, &token, 1); n == 1)
+            return token;
+        else if (n == 0)
+            return cppxx::unexpected_errorf("Jobserver was closed");
+        else if (errno != EAGAIN and errno != EINTR)
+            return cppxx::unexpected_errorf("Failed to read a jobserver token: {}", std::strerror(errno));
+    }
+}
+
+void Jobserver::release(char token) {
+    while (::write(write_fd, &token, 1) < 0)
+        if (errno != EINTR) {
+            spdlog::warn("Failed to return a jobserver token: {}", std::strerror(errno));
+            return;
+        }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <expected>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+
+
+// GNU make jobserver (https://www.gnu.org/software/make/manual/html_node/Job-Slots.html).
+// Every process implicitly owns one job slot, each additional concurrent job needs a token (a single byte) read
+// from the shared pipe or fifo, which has to be written back once the job is done.
+//
+// As a client, the tokens of a parent make/ninja advertised in MAKEFLAGS are used, so a nested cppxx does not
+// oversubscribe the machine. Otherwise cppxx becomes the server: it fills a pipe with `jobs - 1` tokens and
+// exports MAKEFLAGS, so children like `gcc -flto=jobserver` take their parallel jobs from the same pool.
+class Jobserver {
+public:
+    static std::expected<Jobserver, std::runtime_error> from_env(int jobs);
+
+    Jobserver(Jobserver &&other) noexcept;
+    Jobserver &operator=(Jobserver &&) = delete;
+    ~Jobserver();
+
+    // the implicit slot of this process, shared by every scheduler running in it
+    bool take_implicit() { return implicit.exchange(false); }
+    void release_implicit() { implicit = true; }
+
+    // blocks until a token is available, or fails once `stop` is requested
+    std::expected<char, std::runtime_error> acquire(std::stop_token stop = {});
+    void release(char token);
+
+    bool is_client() const { return not server; }
+
+private:
+    Jobserver(int read_fd, int write_fd, bool server, bool owned)
+        : read_fd(read_fd)
+        , write_fd(write_fd)
+        , server(server)
+        , owned(owned) {}
+
+    int read_fd = -1, write_fd = -1;
+    bool server = false;
+    bool owned = false; // the descriptors were opened by us and are closed on destruction
+    std::atomic_bool implicit = true;
+};
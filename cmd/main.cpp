@@ -5,13 +5,14 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <cppxx/match.h>
 #include "options.h"
+#include "daemon.h"
 
 
 int main(int argc, char **argv) {
     spdlog::set_default_logger(spdlog::stderr_color_mt("cppxx"));
     spdlog::set_pattern("[%^%l%$] %v");
 
-    enum struct Subcommand { build, run, compile_commands, add, schema };
+    enum struct Subcommand { build, run, compile_commands, add, schema, daemon, worker };
 
     struct Opts {
         cppxx::cli::Tag<"subcommand,positional", Subcommand> subcommand;
@@ -24,8 +25,13 @@ int main(int argc, char **argv) {
     argv[0] = argv0.data();
     argc -= 1;
 
-    return cppxx::match<std::expected<void, std::runtime_error>>(
-               opts.subcommand(),
+    // a running daemon takes over the subcommands it serves
+    const auto subcommand = opts.subcommand();
+    const bool served = subcommand == Subcommand::build or subcommand == Subcommand::compile_commands or subcommand == Subcommand::run;
+    auto forwarded = served ? forward_to_daemon(rfl::enum_to_string(subcommand), argc, argv) : std::nullopt;
+
+    return (forwarded ? std::move(*forwarded) : cppxx::match<std::expected<void, std::runtime_error>>(
+               subcommand,
                {
                    {Subcommand::build,            [&]() { return Build("Build a target specified by cppxx.toml", argc, argv).exec(); }},
                    {Subcommand::run,              [&]() { return Run("Run a single cpp file", argc, argv).exec(); }                   },
@@ -33,7 +39,9 @@ int main(int argc, char **argv) {
                     [&]() { return GenerateCompileCommands("Generate compile_commands.json", argc, argv).exec(); }                    },
                    {Subcommand::add,              [&]() { return Add("Add an archive or a git repository", argc, argv).exec(); }      },
                    {Subcommand::schema,           [&]() { return Schema("Generate json schema for cppxx.json", argc, argv).exec(); }  },
-    })
+                   {Subcommand::daemon,           [&]() { return Daemon("Serve build, compile_commands and run requests of this directory", argc, argv).exec(); }},
+                   {Subcommand::worker,           [&]() { return Worker("Compile preprocessed units for other machines", argc, argv).exec(); }},
+    }))
         .transform_error([](std::runtime_error &&e) {
             const std::string what = e.what();
             spdlog::error(what);
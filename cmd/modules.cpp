@@ -0,0 +1,243 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <rfl/json.hpp>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <ranges>
+#include <sstream>
+#include "modules.h"
+#include "build_log.h"
+#include "scheduler.h"
+#include "system.h"
+
+namespace fs = std::filesystem;
+
+
+// The parts of a P1689r5 scan result that matter here, anything else is ignored
+namespace {
+    struct P1689Provide {
+        rfl::Rename<"logical-name", std::string> logical_name;
+    };
+
+    struct P1689Require {
+        rfl::Rename<"logical-name", std::string> logical_name;
+        rfl::Rename<"lookup-method", std::optional<std::string>> lookup_method; // set for header units
+    };
+
+    struct P1689Rule {
+        std::optional<std::vector<P1689Provide>> provides = std::nullopt;
+        rfl::Rename<"requires", std::optional<std::vector<P1689Require>>> requires_;
+    };
+
+    struct P1689 {
+        std::vector<P1689Rule> rules;
+    };
+
+    bool is_clang(const CompileCommand &cc) {
+        const auto args = split_args(cc.base_command());
+        return not args.empty() and fs::path(args[0]).filename().string().contains("clang");
+    }
+
+    std::string ddi_path(const CompileCommand &cc) { return fs::path(cc.get_abs_path()).replace_extension(".ddi").string(); }
+
+    std::string bmi_path(const CompileCommand &cc) {
+        return fs::path(cc.get_abs_path()).replace_extension(is_clang(cc) ? ".pcm" : ".gcm").string();
+    }
+
+    std::string quote(const std::string &arg) {
+        std::string quoted = "'";
+        for (char c : arg)
+            quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        return quoted + '\'';
+    }
+
+    // clang-scan-deps of the same toolchain, e.g. clang-scan-deps-18 for clang++-18
+    std::string scan_deps_of(const std::string &compiler) {
+        std::string name = fs::path(compiler).filename().string();
+        const size_t pos = name.find("clang");
+        name.replace(pos, name.find("clang++") == pos ? 7 : 5, "clang-scan-deps");
+        return (fs::path(compiler).parent_path() / name).string();
+    }
+
+    std::expected<void, std::runtime_error> scan(const CompileCommand &cc, std::stop_token stop) {
+        const std::string ddi = ddi_path(cc), object = cc.get_abs_path();
+        std::error_code ec;
+        fs::create_directories(fs::path(ddi).parent_path(), ec);
+        cppxx::defer _ = [&]() { fs::remove(ddi + ".d", ec); };
+
+        std::vector<std::string> args;
+        if (is_clang(cc)) {
+            // clang-scan-deps prints the result
+            auto command = split_args(cc.base_command());
+            const std::string scanner = scan_deps_of(command[0]);
+            command.insert(command.end(), {"-x", "c++", cc.file, "-c", "-o", object});
+            args = {"sh", "-c", fmt::format("exec {} -format=p1689 -- {} > {}", quote(scanner),
+                                            fmt::join(command | std::views::transform(quote), " "), quote(ddi))};
+        } else {
+            args = split_args(cc.base_command());
+            args.insert(args.end(), {"-E", "-x", "c++", cc.file, "-o", "/dev/null", "-MT", ddi, "-MD", "-MF", ddi + ".d",
+                                     "-fdeps-format=p1689r5", "-fdeps-file=" + ddi, "-fdeps-target=" + object});
+        }
+
+        if (auto res = spawn(args, cc.directory, false, stop); not res) {
+            fs::remove(ddi, ec);
+            return cppxx::unexpected_errorf("Failed to scan {:?} for modules: {}", cc.file, res.error().what());
+        }
+        return {};
+    }
+
+    std::expected<ModuleUnit, std::runtime_error> read_ddi(const CompileCommand &cc) {
+        const std::string path = ddi_path(cc);
+        std::ifstream is(path);
+        if (not is.is_open())
+            return cppxx::unexpected_errorf("Cannot open scan result {:?}", path);
+
+        std::stringstream ss;
+        ss << is.rdbuf();
+        auto p1689 = rfl::json::read<P1689>(ss.str());
+        if (not p1689)
+            return cppxx::unexpected_errorf("Invalid scan result {:?}: {}", path, p1689.error().what());
+
+        ModuleUnit unit;
+        for (const auto &rule : p1689->rules) {
+            for (const auto &provide : rule.provides.value_or(std::vector<P1689Provide>{}))
+                unit.provides.push_back(provide.logical_name());
+            for (const auto &require : rule.requires_().value_or(std::vector<P1689Require>{})) {
+                if (require.lookup_method())
+                    return cppxx::unexpected_errorf("{:?} imports the header unit {:?}, header units are not supported", cc.file,
+                                                    require.logical_name());
+                unit.needs.push_back(require.logical_name());
+            }
+        }
+        return unit;
+    }
+
+    // GCC reads `<module> <bmi>` lines, clang the equivalent options
+    std::expected<void, std::runtime_error> write_map(const CompileCommand &cc, const ModuleUnit &unit) {
+        const bool clang = is_clang(cc);
+        std::string content;
+        if (clang and not unit.bmi.empty())
+            content += fmt::format("-fmodule-output={}\n", unit.bmi);
+        for (const auto &name : unit.provides)
+            if (not clang)
+                content += fmt::format("{} {}\n", name, unit.bmi);
+        for (const auto &[name, bmi] : unit.imports)
+            content += clang ? fmt::format("-fmodule-file={}={}\n", name, bmi) : fmt::format("{} {}\n", name, bmi);
+
+        const std::string &path = cc.modules();
+        if (std::ifstream is(path); is.is_open()) {
+            std::stringstream ss;
+            ss << is.rdbuf();
+            if (ss.str() == content)
+                return {};
+        }
+
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        if (std::ofstream os(path); not (os << content))
+            return cppxx::unexpected_errorf("Cannot write module map {:?}", path);
+        return {};
+    }
+} // namespace
+
+std::optional<std::string> ModuleUnit::imports_key() const {
+    std::string key;
+    for (const auto &[name, bmi] : imports) {
+        std::ifstream is(bmi, std::ios::binary);
+        if (not is.is_open())
+            return std::nullopt;
+        std::stringstream ss;
+        ss << is.rdbuf();
+        key += fmt::format("{} {:x}\n", name, BuildLog::hash(ss.str()));
+    }
+    return key;
+}
+
+std::expected<Modules, std::runtime_error> Modules::New(const std::vector<const CompileCommand *> &ccs,
+                                                        DependencyGraph &graph,
+                                                        int jobs,
+                                                        Jobserver *jobserver,
+                                                        std::stop_token stop) {
+    Modules modules;
+    if (ccs.empty())
+        return modules;
+
+    // an object that is up to date was compiled from the source its last scan saw
+    Scheduler scheduler;
+    for (const auto *cc : ccs)
+        if (std::error_code ec; graph.is_dirty(*cc) or not fs::exists(ddi_path(*cc), ec))
+            scheduler.add({.name = cc->file, .run = [cc, stop]() { return scan(*cc, stop); }, .category = "scan"});
+
+    if (scheduler.size() > 0) {
+        spdlog::info("scanning {} sources for modules", scheduler.size());
+        if (auto res = scheduler.run(jobs, jobserver, stop); not res)
+            return cppxx::unexpected_move(res);
+    }
+
+    for (const auto *cc : ccs) {
+        auto unit = read_ddi(*cc);
+        if (not unit)
+            return cppxx::unexpected_move(unit);
+        if (not unit->provides.empty())
+            unit->bmi = bmi_path(*cc);
+
+        for (const auto &name : unit->provides)
+            if (auto [it, ok] = modules.provider.emplace(name, cc); not ok)
+                return cppxx::unexpected_errorf("Module {:?} is provided by both {:?} and {:?}", name, it->second->file, cc->file);
+        modules.units.emplace(cc->get_abs_path(), std::move(*unit));
+    }
+
+    // depth first, so the imports of a unit are complete before its importers collect them
+    std::unordered_map<std::string, bool> finished;
+    std::function<std::expected<void, std::runtime_error>(const CompileCommand &)> resolve =
+        [&](const CompileCommand &cc) -> std::expected<void, std::runtime_error> {
+        const std::string object = cc.get_abs_path();
+        if (auto [it, fresh] = finished.emplace(object, false); not fresh) {
+            if (not it->second)
+                return cppxx::unexpected_errorf("Modules imported by {:?} import it in turn", cc.file);
+            return {};
+        }
+
+        auto &unit = modules.units.at(object);
+        std::map<std::string, std::string> imports;
+        for (const auto &name : unit.needs) {
+            auto it = modules.provider.find(name);
+            if (it == modules.provider.end())
+                return cppxx::unexpected_errorf("Module {:?} imported by {:?} is not provided by any source", name, cc.file);
+            if (auto res = resolve(*it->second); not res)
+                return res;
+
+            const auto &dep = modules.units.at(it->second->get_abs_path());
+            imports.emplace(name, dep.bmi);
+            imports.insert(dep.imports.begin(), dep.imports.end());
+        }
+
+        unit.imports.assign(imports.begin(), imports.end());
+        finished[object] = true;
+        return write_map(cc, unit);
+    };
+
+    for (const auto *cc : ccs)
+        if (auto res = resolve(*cc); not res)
+            return cppxx::unexpected_move(res);
+
+    return modules;
+}
+
+const ModuleUnit *Modules::find(const CompileCommand &cc) const {
+    auto it = units.find(cc.get_abs_path());
+    return it == units.end() ? nullptr : &it->second;
+}
+
+std::vector<const CompileCommand *> Modules::providers(const CompileCommand &cc) const {
+    std::vector<const CompileCommand *> result;
+    if (const auto *unit = find(cc))
+        for (const auto &name : unit->needs)
+            if (auto it = provider.find(name); it != provider.end() and it->second != &cc)
+                result.push_back(it->second);
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <expected>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "compile_command.h"
+#include "dependency_graph.h"
+#include "jobserver.h"
+
+
+// C++20 named modules. The sources of targets with `modules = true` are scanned for the modules they provide and
+// import (P1689 via `-fdeps-format=p1689r5`, or clang-scan-deps for clang). The scan result is kept next to the object
+// as `.ddi` and only redone when the object is out of date. Each unit then gets a module map, a GCC `-fmodule-mapper`
+// file or a clang response file, naming the BMI it writes next to its object and the BMIs of everything it imports
+struct ModuleUnit {
+    std::vector<std::string> provides, needs; // logical names, as scanned
+    std::string bmi = "";                     // written by this unit if it provides a module
+    std::vector<std::pair<std::string, std::string>> imports = {}; // name and BMI of every module imported, directly or not
+
+    // the imported BMIs by content, for the object cache key of this unit
+    std::optional<std::string> imports_key() const;
+};
+
+class Modules {
+public:
+    // scan the units that are out of date in parallel, read the others from their last scan, check that every import
+    // is provided exactly once and without cycles, and write the module maps
+    static std::expected<Modules, std::runtime_error> New(const std::vector<const CompileCommand *> &ccs,
+                                                          DependencyGraph &graph,
+                                                          int jobs,
+                                                          Jobserver *jobserver,
+                                                          std::stop_token stop);
+
+    const ModuleUnit *find(const CompileCommand &cc) const;
+
+    // the units providing the modules `cc` imports directly
+    std::vector<const CompileCommand *> providers(const CompileCommand &cc) const;
+
+private:
+    std::unordered_map<std::string, ModuleUnit> units;              // by object
+    std::unordered_map<std::string, const CompileCommand *> provider; // by module name
+};
@@ -0,0 +1,129 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <cppxx/error.h>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include "object_cache.h"
+
+namespace fs = std::filesystem;
+
+static constexpr uintmax_t default_max_size = uintmax_t(5) << 30;
+
+
+static std::optional<uintmax_t> parse_size(const std::string &s) {
+    size_t pos = 0;
+    uintmax_t value = 0;
+    try {
+        value = std::stoull(s, &pos);
+    } catch (std::exception &) {
+        return std::nullopt;
+    }
+
+    const std::string suffix = s.substr(pos);
+    if (suffix.empty())
+        return value;
+    if (suffix == "K" or suffix == "k")
+        return value << 10;
+    if (suffix == "M" or suffix == "m")
+        return value << 20;
+    if (suffix == "G" or suffix == "g")
+        return value << 30;
+    return std::nullopt;
+}
+
+
+ObjectCache::ObjectCache(std::string dir, uintmax_t max_size)
+    : dir(std::move(dir)),
+      max_size(max_size) {}
+
+ObjectCache ObjectCache::from_env(const std::string &cache) {
+    uintmax_t max_size = default_max_size;
+    if (const char *env = std::getenv("CPPXX_CACHE_SIZE")) {
+        if (auto size = parse_size(env))
+            max_size = *size;
+        else
+            spdlog::warn("Ignoring invalid {:?} = {:?}", "CPPXX_CACHE_SIZE", env);
+    }
+
+    return ObjectCache((fs::path(cache) / "objects").string(), max_size);
+}
+
+bool ObjectCache::fetch(const std::string &key, const std::string &dest) const {
+    const fs::path src = path_of(key);
+
+    std::error_code ec; // a broken entry is just a miss
+    if (not fs::copy_file(src, dest, fs::copy_options::overwrite_existing, ec) or ec)
+        return false;
+
+    // the mtime doubles as the last access time for eviction
+    fs::last_write_time(src, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+std::expected<void, std::runtime_error> ObjectCache::store(const std::string &key, const std::string &src) {
+    const fs::path dest = path_of(key);
+    const fs::path tmp = fmt::format("{}.{}.tmp", dest.string(), ::getpid());
+
+    try {
+        fs::create_directories(dest.parent_path());
+        fs::copy_file(src, tmp, fs::copy_options::overwrite_existing);
+        fs::rename(tmp, dest); // concurrent stores of the same key are harmless, the contents are identical
+    } catch (std::exception &e) {
+        std::error_code ec;
+        fs::remove(tmp, ec);
+        return cppxx::unexpected_errorf("Failed to store {:?} into the object cache: {}", src, e.what());
+    }
+
+    return {};
+}
+
+std::expected<void, std::runtime_error> ObjectCache::evict() const {
+    struct Item {
+        fs::path path;
+        uintmax_t size;
+        fs::file_time_type atime;
+    };
+
+    std::vector<Item> items;
+    uintmax_t total = 0;
+    try {
+        if (not fs::exists(dir))
+            return {};
+
+        for (const auto &entry : fs::recursive_directory_iterator(dir)) {
+            if (not entry.is_regular_file() or entry.path().extension() == ".tmp")
+                continue;
+            items.push_back({entry.path(), entry.file_size(), entry.last_write_time()});
+            total += items.back().size;
+        }
+    } catch (std::exception &e) {
+        return cppxx::unexpected_errorf("Failed to scan the object cache {:?}: {}", dir, e.what());
+    }
+
+    if (total <= max_size)
+        return {};
+
+    // leave some headroom so that the next build does not evict again right away
+    const uintmax_t target = max_size / 10 * 9;
+    std::ranges::sort(items, {}, &Item::atime);
+
+    size_t evicted = 0;
+    for (const auto &item : items) {
+        if (total <= target)
+            break;
+
+        std::error_code ec;
+        if (fs::remove(item.path, ec); not ec) {
+            total -= item.size;
+            ++evicted;
+        }
+    }
+
+    spdlog::debug("evicted {} objects from {:?}", evicted, dir);
+    return {};
+}
+
+std::string ObjectCache::path_of(const std::string &key) const {
+    return (fs::path(dir) / key.substr(0, 2) / fmt::format("{}.o", key.substr(2))).string();
+}
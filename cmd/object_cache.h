@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <stdexcept>
+#include <string>
+
+
+// Content-addressed store of compiled objects shared by every workspace and branch using the same `$CPPXX_CACHE`.
+// Objects are keyed by the hash of the preprocessed source and the command, and evicted least recently used first
+// once the store grows beyond `max_size` bytes (`$CPPXX_CACHE_SIZE`, e.g. "10G", defaults to 5G).
+class ObjectCache {
+public:
+    ObjectCache(std::string dir, uintmax_t max_size);
+
+    static ObjectCache from_env(const std::string &cache);
+
+    // copy the object stored under `key` into `dest`, returns false on a miss
+    bool fetch(const std::string &key, const std::string &dest) const;
+    std::expected<void, std::runtime_error> store(const std::string &key, const std::string &src);
+
+    // drop the least recently used objects until the store fits into its budget again
+    std::expected<void, std::runtime_error> evict() const;
+
+private:
+    std::string path_of(const std::string &key) const;
+
+    std::string dir;
+    uintmax_t max_size;
+};
@@ -5,6 +5,10 @@
 #include <expected>
 
 
+// How the arguments of a subcommand are parsed: `cppxx::cli::parse` exits on `--help` or an error,
+// the daemon uses `cppxx::cli::parse_or_throw` instead
+using Parse = decltype(&cppxx::cli::parse);
+
 struct Base {
     Base() = default;
     virtual ~Base() = default;
@@ -16,7 +20,7 @@ struct GenerateCompileCommands : Base {
     std::string target;
     std::optional<std::string> root;
 
-    GenerateCompileCommands(const std::string &name, int argc, char **argv) {
+    GenerateCompileCommands(const std::string &name, int argc, char **argv, Parse parse = cppxx::cli::parse) {
         const std::vector<cppxx::cli::Option> options = {
             {
              .target = &target,
@@ -31,37 +35,63 @@ struct GenerateCompileCommands : Base {
              .help = "Specify root dir containing cppxx.toml",
              },
         };
-        cppxx::cli::parse(name, argc, argv, options);
+        parse(name, argc, argv, options);
     }
 
     std::expected<void, std::runtime_error> exec() override;
 };
 
 struct Build : Base {
-    std::string target;
-    std::optional<int> jobs = 2;
-    std::optional<std::string> out, root;
+    std::optional<std::vector<std::string>> targets;
+    bool all = false, time_trace = false, watch = false;
+    std::optional<int> jobs = std::nullopt;
+    std::optional<std::string> out, root, trace, pgo;
 
-    Build(const std::string &name, int argc, char **argv) {
+    Build(const std::string &name, int argc, char **argv, Parse parse = cppxx::cli::parse) {
         const std::vector<cppxx::cli::Option> options = {
             {
-             .target = &target,
+             .target = &targets,
              .key_char = 't',
              .key_str = "target",
-             .help = "Specify an executable or lib target",
+             .help = "Specify one or more executable or lib targets",
              .is_positional = true,
              },
+            {
+             .target = &all,
+             .key_str = "all",
+             .help = "Build every bin target",
+             },
             {
              .target = &out,
              .key_char = 'o',
              .key_str = "out",
-             .help = "Specify output name",
+             .help = "Specify output name (only for a single target)",
              },
             {
              .target = &jobs,
              .key_char = 'j',
              .key_str = "threads",
-             .help = "Number of threads",
+             .help = "Number of parallel jobs, defaults to the number of online CPUs",
+             },
+            {
+             .target = &trace,
+             .key_str = "trace",
+             .help = "Write a Chrome trace of the build timeline to this file",
+             },
+            {
+             .target = &time_trace,
+             .key_str = "time-trace",
+             .help = "Compile with clang's -ftime-trace and merge it into the trace",
+             },
+            {
+             .target = &watch,
+             .key_str = "watch",
+             .help = "Keep running and rebuild whenever a source, header or cppxx.toml changes",
+             },
+            {
+             .target = &pgo,
+             .key_str = "pgo",
+             .help = "Optimize with the profile of this training command, run with the instrumented outputs first on PATH",
              },
             {
              .target = &root,
@@ -69,7 +99,7 @@ struct Build : Base {
              .help = "Specify root dir containing cppxx.toml",
              },
         };
-        cppxx::cli::parse(name, argc, argv, options);
+        parse(name, argc, argv, options);
     }
 
     std::expected<void, std::runtime_error> exec() override;
@@ -79,7 +109,7 @@ struct Run : Base {
     std::string file;
     std::vector<std::string> args;
 
-    Run(const std::string &name, int argc, char **argv) {
+    Run(const std::string &name, int argc, char **argv, Parse parse = cppxx::cli::parse) {
         const std::vector<cppxx::cli::Option> options = {
             {
              .target = &file,
@@ -89,7 +119,7 @@ struct Run : Base {
              .is_positional = true,
              },
         };
-        cppxx::cli::parse(name, std::min(argc, 2), argv, options);
+        parse(name, std::min(argc, 2), argv, options);
 
         argc -= 1;
         argv += 1;
@@ -97,6 +127,8 @@ struct Run : Base {
             args.emplace_back(argv[i]);
     }
 
+    // the path of the up to date executable
+    std::expected<std::string, std::runtime_error> compile();
     std::expected<void, std::runtime_error> exec() override;
 };
 
@@ -134,3 +166,49 @@ struct Schema : Base {
     }
     std::expected<void, std::runtime_error> exec() override;
 };
+
+struct Daemon : Base {
+    std::optional<int> jobs = std::nullopt;
+
+    Daemon(const std::string &name, int argc, char **argv) {
+        const std::vector<cppxx::cli::Option> options = {
+            {
+             .target = &jobs,
+             .key_char = 'j',
+             .key_str = "threads",
+             .help = "Number of parallel jobs shared by every client, defaults to the number of online CPUs",
+             },
+        };
+        cppxx::cli::parse(name, argc, argv, options);
+    }
+    std::expected<void, std::runtime_error> exec() override;
+};
+
+struct Worker : Base {
+    std::optional<std::string> listen = std::nullopt;
+    std::optional<int> port = std::nullopt, jobs = std::nullopt;
+
+    Worker(const std::string &name, int argc, char **argv) {
+        const std::vector<cppxx::cli::Option> options = {
+            {
+             .target = &listen,
+             .key_str = "listen",
+             .help = "Address to accept clients on, defaults to 127.0.0.1. Only listen on networks you trust",
+             },
+            {
+             .target = &port,
+             .key_char = 'p',
+             .key_str = "port",
+             .help = "Port to accept clients on, defaults to 3633",
+             },
+            {
+             .target = &jobs,
+             .key_char = 'j',
+             .key_str = "threads",
+             .help = "Number of parallel compiles, defaults to the number of online CPUs",
+             },
+        };
+        cppxx::cli::parse(name, argc, argv, options);
+    }
+    std::expected<void, std::runtime_error> exec() override;
+};
@@ -2,80 +2,32 @@
 #include <spdlog/spdlog.h>
 #include <cppxx/error.h>
 #include <filesystem>
-#include <regex>
 #include "workspace.h"
+#include "glob.h"
 
 namespace fs = std::filesystem;
 
 
-static auto expand_path(const std::string &pattern) -> std::vector<std::string> {
-    std::vector<std::string> result;
-
-    bool recursive = pattern.find("**") != std::string::npos;
-    auto last_slash = pattern.rfind('/');
-    std::string dir = last_slash != std::string::npos ? pattern.substr(0, last_slash) : ".";
-    std::string filename_pattern = pattern.substr(last_slash + 1);
-
-    // Translate glob to regex:
-    // - **  -> .*
-    // - *   -> [^/]*   (matches any except slash)
-    // - ?   -> .       (any single character)
-    std::string regex_str;
-    for (size_t i = 0; i < filename_pattern.size(); ++i) {
-        if (filename_pattern[i] == '*') {
-            if (i + 1 < filename_pattern.size() && filename_pattern[i + 1] == '*') {
-                regex_str += ".*";
-                ++i; // skip next '*'
-            } else {
-                regex_str += "[^/]*";
-            }
-        } else if (filename_pattern[i] == '?') {
-            regex_str += '.';
-        } else if (std::strchr(".^$|()[]{}+\\", filename_pattern[i])) {
-            regex_str += '\\';
-            regex_str += filename_pattern[i];
-        } else {
-            regex_str += filename_pattern[i];
-        }
-    }
-
-    std::regex regex_pattern("^" + regex_str + "$");
-
-    if (recursive) {
-        for (const auto &entry : fs::recursive_directory_iterator(dir)) {
-            if (entry.is_regular_file() && std::regex_match(entry.path().filename().string(), regex_pattern)) {
-                result.push_back(entry.path().string());
-            }
-        }
-    } else {
-        for (const auto &entry : fs::directory_iterator(dir)) {
-            if (entry.is_regular_file() && std::regex_match(entry.path().filename().string(), regex_pattern)) {
-                result.push_back(entry.path().string());
-            }
-        }
-    }
-
-    return result;
-}
-
-static void collect_expanded_paths(const std::string &root,
+static void collect_expanded_paths(Glob &glob,
+                                   const std::string &root,
                                    const std::unordered_map<std::string, std::string> &populated,
                                    std::vector<std::string> &paths,
                                    bool expand = true) {
     std::vector<std::string> collected;
-    for (auto src : paths) {
-        src = populated.at(src);
+    for (const auto &path : paths) {
+        const bool negate = expand and path.starts_with('!');
+        std::string src = negate ? path.substr(1) : populated.at(path);
         if (fs::path(src).is_relative())
             src = root / fs::path(src);
-
-        std::vector<std::string> to_append = expand ? expand_path(src) : std::vector{src};
-        std::ranges::move(to_append, std::back_inserter(collected));
+        collected.push_back(negate ? '!' + src : std::move(src));
     }
 
+    if (expand)
+        collected = cppxx::try_(glob.expand(collected));
     paths = std::move(collected);
 }
 
-void resolve_paths(Target &t, const std::unordered_map<std::string, std::string> &populated) {
+void resolve_paths(Glob &glob, Target &t, const std::unordered_map<std::string, std::string> &populated) {
     fs::path root;
     if (t.git) {
         root = populated.at(t.git->as_key());
@@ -86,31 +38,34 @@ void resolve_paths(Target &t, const std::unordered_map<std::string, std::string>
     }
 
     if (t.sources)
-        collect_expanded_paths(root, populated, t.sources.value());
+        collect_expanded_paths(glob, root, populated, t.sources.value());
 
     if (t.include_dirs && std::holds_alternative<Extended>(t.include_dirs.value())) {
-        collect_expanded_paths(root, populated, std::get<Extended>(t.include_dirs.value()).public_(), false);
-        collect_expanded_paths(root, populated, std::get<Extended>(t.include_dirs.value()).private_(), false);
+        collect_expanded_paths(glob, root, populated, std::get<Extended>(t.include_dirs.value()).public_(), false);
+        collect_expanded_paths(glob, root, populated, std::get<Extended>(t.include_dirs.value()).private_(), false);
     } else if (t.include_dirs && std::holds_alternative<std::vector<std::string>>(t.include_dirs.value())) {
-        collect_expanded_paths(root, populated, std::get<std::vector<std::string>>(t.include_dirs.value()), false);
+        collect_expanded_paths(glob, root, populated, std::get<std::vector<std::string>>(t.include_dirs.value()), false);
     }
 }
 
 std::expected<Workspace, std::runtime_error> resolve_paths(Workspace &&w) {
     auto &populated = w.populated();
+    Glob glob;
     try {
         if (w.interface)
             for (auto &[name, t] : w.interface.value())
-                resolve_paths(t, populated);
+                resolve_paths(glob, t, populated);
         if (w.lib)
             for (auto &[name, t] : w.lib.value())
-                resolve_paths(t, populated);
+                resolve_paths(glob, t, populated);
         if (w.bin)
             for (auto &[name, t] : w.bin.value())
-                resolve_paths(t, populated);
+                resolve_paths(glob, t, populated);
     } catch (std::runtime_error &e) {
         return cppxx::unexpected_errorf("Failed to resolve paths: {}", e.what());
     }
 
+    w.globbed() = glob.directories();
+
     return std::move(w);
 }
@@ -1,47 +1,24 @@
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
-#include <cppxx/defer.h>
 #include <cppxx/error.h>
+#include <cppxx/iterator.h>
+#include <cppxx/multithreading/pool.h>
+#include <algorithm>
 #include <filesystem>
 #include <cstdlib>
+#include <functional>
+#include <thread>
 #include <unordered_set>
 #include "workspace.h"
+#include "archive.h"
 #include "system.h"
+#include "trace.h"
 
 namespace fs = std::filesystem;
 
 
-static fs::path get_top_level_path_from_tar(const std::string &tar_file) {
-    std::vector<std::string> result;
-    std::unordered_set<std::string> unique_entries;
-
-    std::string command = fmt::format("tar tf '{}' | cut -d/ -f1 | uniq", tar_file);
-    auto pipe = popen(command.c_str(), "r");
-    cppxx::defer _ = [&]() { pclose(pipe); };
-
-    if (!pipe)
-        throw std::runtime_error(fmt::format("Failed to run tar command for {:?}", tar_file));
-
-    char buffer[4096];
-    while (fgets(buffer, sizeof(buffer), pipe)) {
-        std::string line(buffer);
-        if (line.empty())
-            continue;
-        if (line.back() == '\n')
-            line.pop_back();
-        if (unique_entries.insert(line).second)
-            result.emplace_back(line);
-    }
-
-    if (result.empty())
-        throw std::runtime_error(fmt::format("Failed to get the top level path from {:?}", tar_file));
-
-    // TODO: what if the tar_file has multiple paths
-    if (result.size() > 1)
-        throw std::runtime_error(fmt::format("Multiple top level paths from {:?} are not supported. The paths are: {}", tar_file,
-                                             fmt::join(result, " ")));
-
-    return result.front();
+static bool is_remote_uri(const std::string &uri) {
+    return uri.starts_with("http://") or uri.starts_with("https://") or uri.starts_with("ftp://") or uri.starts_with("sftp://");
 }
 
 static auto populate_archive(const fs::path &cache, const std::string &uri_string) -> std::string {
@@ -49,49 +26,39 @@ static auto populate_archive(const fs::path &cache, const std::string &uri_strin
     const fs::path extract_dir = cache / "extracted";
 
     const fs::path uri = uri_string;
-    const std::string extension = uri.extension().string();
-    const bool is_remote = uri_string.starts_with("http://") or uri_string.starts_with("https://")
-        or uri_string.starts_with("ftp://") or uri_string.starts_with("sftp://");
-    const bool is_compressed = extension == ".tar" or extension == ".tgz" or extension == ".gz" or extension == ".tbz2"
-        or extension == ".bz2" or extension == ".xz"; // TODO: zip?
+    const bool is_remote = is_remote_uri(uri_string);
+    const bool is_compressed = is_archive(uri_string);
 
     if (is_remote) {
         const fs::path archive_path = archive_dir / uri.filename();
 
-        if (not fs::exists(archive_path)) {
-            fs::create_directories(archive_dir);
-            const std::string cmd = fmt::format("curl -sSfL -o '{}' '{}'", archive_path.string(), uri_string);
+        auto res = populate_once(archive_path.string(), [&](const std::string &tmp) {
             spdlog::info("downloading {:?} to {:?}", uri_string, archive_path.string());
-            if (auto res = system(cmd); not res)
-                throw cppxx::errorf("Failed to download archive from {:?}, {}", uri_string, res.error().what());
-        }
+            return system(fmt::format("curl -sSfL -o '{}' '{}'", tmp, uri_string));
+        });
+        if (not res)
+            throw cppxx::errorf("Failed to download archive from {:?}, {}", uri_string, res.error().what());
 
         return populate_archive(cache, archive_path.string());
     }
 
     if (is_compressed) {
-        const fs::path extract_path = extract_dir / get_top_level_path_from_tar(uri_string);
-        if (not fs::exists(extract_path)) {
-            fs::create_directories(extract_dir);
-            std::string extract_cmd;
-            if (extension == ".tar") {
-                extract_cmd = fmt::format("tar -xf '{}' -C '{}'", uri_string, extract_dir.string());
-            } else if (extension == ".gz" or extension == ".tgz") {
-                extract_cmd = fmt::format("tar -xzf '{}' -C '{}'", uri_string, extract_dir.string());
-            } else if (extension == ".bz2" or extension == ".tbz2") {
-                extract_cmd = fmt::format("tar -xjf '{}' -C '{}'", uri_string, extract_dir.string());
-            } else if (extension == ".xz") {
-                extract_cmd = fmt::format("tar -xJf '{}' -C '{}'", uri_string, extract_dir.string());
-            } else {
-                throw std::runtime_error(fmt::format("Unsupported archive type {:?}", uri_string));
-            }
-
-            spdlog::info("extracting {:?} to {:?}", uri_string, extract_dir.string());
-            if (auto res = system(extract_cmd); not res)
-                throw cppxx::errorf("Failed to extract {:?}, {}", uri_string, res.error().what());
-        }
-
-        return populate_archive(cache, extract_path.string());
+        const fs::path extract_path = extract_dir / uri.filename();
+
+        auto res = populate_once(extract_path.string(), [&](const std::string &tmp) {
+            spdlog::info("extracting {:?} to {:?}", uri_string, extract_path.string());
+            return extract_archive(uri_string, tmp);
+        });
+        if (not res)
+            throw cppxx::errorf("Failed to extract {:?}, {}", uri_string, res.error().what());
+
+        // archives usually wrap everything in a single top level directory, which is then the root
+        std::vector<fs::path> entries;
+        for (const auto &entry : fs::directory_iterator(extract_path))
+            entries.push_back(entry.path());
+        if (entries.size() == 1 and fs::is_directory(entries.front()))
+            return entries.front().string();
+        return extract_path.string();
     }
 
     if (uri.is_absolute() and not fs::exists(uri))
@@ -101,43 +68,105 @@ static auto populate_archive(const fs::path &cache, const std::string &uri_strin
     return uri_string;
 }
 
-static void populate_remotes(std::unordered_map<std::string, std::string> &populated,
-                             const fs::path &cache,
-                             const std::string &name,
-                             Target &t) {
+// A download, extraction or clone that is run on the fetch pool, keyed by the URI or `Git::as_key()`
+struct Fetch {
+    std::string key;
+    std::function<std::expected<std::string, std::runtime_error>()> run;
+};
+
+static void collect_remotes(std::unordered_map<std::string, std::string> &populated,
+                            std::vector<Fetch> &fetches,
+                            std::unordered_set<std::string> &queued,
+                            const fs::path &cache,
+                            const std::string &name,
+                            const Target &t) {
     if (t.archive and t.git)
         throw std::runtime_error(fmt::format(
             "multiple source detected from target {:?}: remote source could only be specified by {:?} or {:?} exclusively", name,
             "archive", "git"));
+
+    // local paths are resolved right away, anything that needs the network or an extraction is fetched concurrently
+    auto add_archive = [&](const std::string &uri) {
+        if (populated.contains(uri) or queued.contains(uri))
+            return;
+        if (not is_remote_uri(uri) and not is_archive(uri)) {
+            populated.emplace(uri, populate_archive(cache, uri));
+            return;
+        }
+
+        queued.insert(uri);
+        fetches.push_back({
+            .key = uri,
+            .run = [cache, uri]() -> std::expected<std::string, std::runtime_error> {
+                try {
+                    return populate_archive(cache, uri);
+                } catch (std::runtime_error &e) {
+                    return std::unexpected(std::move(e));
+                }
+            },
+        });
+    };
+
     if (t.archive)
-        populated.emplace(t.archive.value(), populate_archive(cache, t.archive.value()));
+        add_archive(t.archive.value());
     if (t.git) {
         auto key = t.git->as_key();
-        if (not populated.contains(key)) {
-            auto path = t.git->clone(cache);
-            if (path)
-                populated.emplace(key, path.value());
-            else
-                throw std::move(path.error());
-        }
+        if (not populated.contains(key) and queued.insert(key).second)
+            fetches.push_back({.key = key, .run = [cache, git = t.git.value()]() { return git.clone(cache); }});
     }
     if (t.sources)
         for (auto &v : t.sources.value())
-            populated.emplace(v, populate_archive(cache, v));
+            add_archive(v);
     if (t.include_dirs) {
         if (std::holds_alternative<Extended>(t.include_dirs.value())) {
             auto &e = std::get<Extended>(t.include_dirs.value());
             for (auto &path : e.public_())
-                populated.emplace(path, populate_archive(cache, path));
+                add_archive(path);
             for (auto &path : e.private_())
-                populated.emplace(path, populate_archive(cache, path));
+                add_archive(path);
         } else if (std::holds_alternative<std::vector<std::string>>(t.include_dirs.value())) {
             for (auto &path : std::get<std::vector<std::string>>(t.include_dirs.value()))
-                populated.emplace(path, populate_archive(cache, path));
+                add_archive(path);
         }
     }
 }
 
+// run the fetches on a bounded pool, so a cold cache costs about as much as the slowest dependency
+static std::expected<void, std::runtime_error> fetch_remotes(std::unordered_map<std::string, std::string> &populated,
+                                                             const std::vector<Fetch> &fetches) {
+    if (fetches.empty())
+        return {};
+
+    using Result = std::pair<std::string, std::expected<std::string, std::runtime_error>>;
+    const int workers = std::clamp<int>(std::thread::hardware_concurrency(), 1, fetches.size());
+    cppxx::multithreading::Pool<Result> pool(workers);
+
+    for (auto &&[i, fetch] : fetches | cppxx::enumerate(size_t(0)))
+        pool << [&fetch, lane = int64_t(i % workers + 1)]() -> Result {
+            Trace::set_thread(lane);
+            Trace::Scope _(fetch.key, "fetch");
+            return {fetch.key, fetch.run()};
+        };
+
+    std::optional<std::runtime_error> err = std::nullopt;
+    for (size_t done = 1; done <= fetches.size(); ++done) {
+        pool >> [&](Result &&res) {
+            if (not res.second) {
+                spdlog::error("[{}/{}] failed to fetch {:?}", done, fetches.size(), res.first);
+                if (not err)
+                    err.emplace(std::move(res.second.error()));
+                return;
+            }
+            spdlog::info("[{}/{}] fetched {:?}", done, fetches.size(), res.first);
+            populated.emplace(std::move(res.first), std::move(*res.second));
+        };
+    }
+
+    if (err)
+        return std::unexpected(std::move(*err));
+    return {};
+}
+
 std::expected<Workspace, std::runtime_error> resolve_remotes(Workspace &&w) {
     fs::path cache;
     if (const char *cache_str = std::getenv(CPPXX_CACHE); not cache_str) {
@@ -148,19 +177,24 @@ std::expected<Workspace, std::runtime_error> resolve_remotes(Workspace &&w) {
     }
 
     auto &populated = w.populated();
+    std::vector<Fetch> fetches;
+    std::unordered_set<std::string> queued;
     try {
         if (w.interface)
             for (auto &[name, t] : w.interface.value())
-                populate_remotes(populated, cache, name, t);
+                collect_remotes(populated, fetches, queued, cache, name, t);
         if (w.lib)
             for (auto &[name, t] : w.lib.value())
-                populate_remotes(populated, cache, name, t);
+                collect_remotes(populated, fetches, queued, cache, name, t);
         if (w.bin)
             for (auto &[name, t] : w.bin.value())
-                populate_remotes(populated, cache, name, t);
+                collect_remotes(populated, fetches, queued, cache, name, t);
     } catch (std::runtime_error &e) {
         return cppxx::unexpected_errorf("Failed to resolve remotes: {}", e.what());
     }
 
+    if (auto res = fetch_remotes(populated, fetches); not res)
+        return cppxx::unexpected_errorf("Failed to resolve remotes: {}", res.error().what());
+
     return std::move(w);
 }
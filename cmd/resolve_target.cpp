@@ -63,13 +63,15 @@ static void insert_target(Workspace &dst, const std::string &name, const Target
 }
 
 
-std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&ws, const std::string &target_name) {
+std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&ws, const std::vector<std::string> &target_names) {
     Workspace result{
         .title = ws.title,
         .version = ws.version,
         .compiler = ws.compiler,
         .standard = ws.standard,
         .author = ws.author,
+        .linker = ws.linker,
+        .lto = ws.lto,
         .vars = std::nullopt,
         .interface = std::nullopt,
         .lib = std::nullopt,
@@ -79,6 +81,7 @@ std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&ws, cons
     std::unordered_set<std::string> visited;         // fully processed targets
     std::unordered_set<std::string> recursion_stack; // targets in the current DFS path
 
+    std::string target_name; // the root currently being resolved, for error messages
     std::function<std::expected<void, std::runtime_error>(const std::string &)> dfs;
     dfs = [&](const std::string &name) -> std::expected<void, std::runtime_error> {
         if (recursion_stack.contains(name))
@@ -104,5 +107,16 @@ std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&ws, cons
         return {};
     };
 
-    return dfs(target_name).transform([&]() { return std::move(result); });
+    // targets shared by several roots are only visited once
+    for (const auto &name : target_names) {
+        target_name = name;
+        if (auto r = dfs(name); not r)
+            return cppxx::unexpected_move(r);
+    }
+
+    return result;
+}
+
+std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&ws, const std::string &target_name) {
+    return resolve_target(std::move(ws), std::vector{target_name});
 }
@@ -1,8 +1,12 @@
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
 #include <cppxx/error.h>
+#include <sha256.h>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <thread>
 #include "workspace.h"
 #include "options.h"
 #include "system.h"
@@ -18,7 +22,100 @@ inline std::string strip(const std::string &s, const std::string &chars = " \t\n
     return s.substr(start, end - start + 1);
 }
 
-std::expected<void, std::runtime_error> Run::exec() {
+// The settings in the leading comments of a script, e.g.
+// // compiler: clang++
+// // standard: 20
+// // flags: -Wall -Wextra
+// // mode: release
+// // depends_on: mylib otherlib
+struct Script {
+    std::string content, compiler, standard, flags, mode;
+    std::vector<std::string> depends_on, headers; // workspace libs, and the `<...>` headers included up front
+
+    static std::expected<Script, std::runtime_error> New(const std::string &file) {
+        std::ifstream f(file);
+        if (not f.is_open())
+            return cppxx::unexpected_errorf("File {:?} is not readable", file);
+
+        Script s;
+        std::stringstream ss;
+        ss << f.rdbuf();
+        s.content = ss.str();
+
+        std::istringstream lines(s.content);
+        bool header = true;
+        for (std::string line; std::getline(lines, line);) {
+            line = strip(line);
+            if (header and line.starts_with("//")) {
+                std::string comment = strip(line.substr(2));
+                if (constexpr std::string_view key = "flags:"; comment.starts_with(key) && s.flags.empty()) {
+                    s.flags = strip(comment.substr(key.size()));
+                } else if (constexpr std::string_view key = "compiler:"; comment.starts_with(key) && s.compiler.empty()) {
+                    s.compiler = strip(comment.substr(key.size()));
+                } else if (constexpr std::string_view key = "standard:"; comment.starts_with(key) && s.standard.empty()) {
+                    s.standard = strip(comment.substr(key.size()));
+                } else if (constexpr std::string_view key = "mode:"; comment.starts_with(key) && s.mode.empty()) {
+                    s.mode = strip(comment.substr(key.size()));
+                } else if (constexpr std::string_view key = "depends_on:"; comment.starts_with(key)) {
+                    std::string deps = comment.substr(key.size());
+                    std::ranges::replace(deps, ',', ' ');
+                    std::istringstream words(deps);
+                    for (std::string dep; words >> dep;)
+                        s.depends_on.push_back(std::move(dep));
+                }
+                continue;
+            }
+            header = false;
+
+            // the includes before the first line of code are included first anyway, so they can be precompiled
+            if (line.empty() or line.starts_with("//") or line == "#pragma once")
+                continue;
+            if (not line.starts_with("#include <") or not line.ends_with('>'))
+                break;
+            s.headers.push_back(strip(line.substr(10, line.size() - 11)));
+        }
+
+        if (s.mode.empty())
+            s.mode = "debug";
+        if (s.mode != "debug" and s.mode != "release")
+            return cppxx::unexpected_errorf("Invalid mode {:?} in {:?}, expected \"debug\" or \"release\"", s.mode, file);
+        return s;
+    }
+
+    std::vector<std::string> mode_flags() const {
+        if (mode == "release")
+            return {"-O2", "-DNDEBUG"};
+        return {"-g", "-fsanitize=address,undefined"};
+    }
+
+    // the executable is named after everything it is built from, so scripts of the same name do not collide
+    // and switching between settings does not relink
+    std::string key() const {
+        return SHA256::hashString(fmt::format("{}\n{}\n{}\n{}\n{}\n{}", compiler, standard, flags, mode,
+                                              fmt::join(depends_on, " "), content))
+            .substr(0, 16);
+    }
+};
+
+// The workspace to build the script in, with the libs it depends on if any
+static std::expected<Workspace, std::runtime_error> workspace_of(const Script &s) {
+    if (s.depends_on.empty())
+        return Workspace{.title = "run", .compiler = "c++", .standard = "23"};
+
+    auto resolve = [&]() {
+        return Workspace::New()
+            .and_then(resolve_vars)
+            .and_then([&](Workspace &&w) { return resolve_target(std::move(w), s.depends_on); })
+            .and_then(resolve_remotes)
+            .and_then(resolve_paths);
+    };
+    return resolve_cached("", fmt::format("run {}", fmt::join(s.depends_on, " ")), resolve)
+        .transform_error([](std::runtime_error &&err) {
+            return cppxx::errorf("Cannot resolve the libs the script depends on: {}", err.what());
+        });
+}
+
+std::expected<std::string, std::runtime_error> Run::compile() {
     fs::path cache;
     if (auto env = std::getenv(CPPXX_CACHE); not env)
         return cppxx::unexpected_errorf("env varibale {:?} is not defined", CPPXX_CACHE);
@@ -28,51 +125,54 @@ std::expected<void, std::runtime_error> Run::exec() {
     if (not fs::exists(file))
         return cppxx::unexpected_errorf("File {:?} does not exist", file);
 
-    std::ifstream f(file);
-    if (not f.is_open())
-        return cppxx::unexpected_errorf("File {:?} is not readable", file);
-
-    std::string additional_flags;
-    std::string compiler;
-    std::string standard;
-
-    for (std::string line; std::getline(f, line);) {
-        if (not line.starts_with("//"))
-            break;
-
-        std::string comment = strip(line.substr(2));
-        if (constexpr std::string_view key = "flags:"; comment.starts_with(key) && additional_flags.empty()) {
-            additional_flags = strip(comment.substr(key.size()));
-        } else if (constexpr std::string_view key = "compiler:"; comment.starts_with(key) && compiler.empty()) {
-            compiler = strip(comment.substr(key.size()));
-        } else if (constexpr std::string_view key = "standard:"; comment.starts_with(key) && standard.empty()) {
-            standard = strip(comment.substr(key.size()));
-        }
-    }
-    f.close();
+    auto script = Script::New(file);
+    if (not script)
+        return cppxx::unexpected_move(script);
 
-    if (compiler.empty())
-        compiler = "c++";
-    if (standard.empty())
-        standard = "23";
+    auto w = workspace_of(*script);
+    if (not w)
+        return cppxx::unexpected_move(w);
 
-    const fs::path output_dir = cache / "bin";
-    const fs::path output = output_dir / fs::path(file).filename().stem();
-    fs::create_directories(output_dir);
+    // the settings of the script take precedence over the ones of the workspace
+    if (not script->compiler.empty())
+        w->compiler = script->compiler;
+    if (not script->standard.empty())
+        w->standard = script->standard;
+    if (w->compiler.empty())
+        w->compiler = "c++";
 
-    if (not fs::exists(output) or fs::last_write_time(file) > fs::last_write_time(output)) {
-        spdlog::info("compiling {:?}", file);
-        std::vector<std::string> flags = {additional_flags, "-g", "-fsanitize=address,undefined", "-I" + cache.string()};
+    // named after its path, which no target of the workspace can be
+    const std::string source = fs::absolute(file).lexically_normal().string();
+    std::vector<std::string> flags = split_args(script->flags), mode = script->mode_flags();
+    flags.insert(flags.end(), mode.begin(), mode.end());
+    flags.push_back("-I" + cache.string());
 
-        if (auto res = system(
-                fmt::format("{} -std=c++{} {} {} -o {}", compiler, standard, fmt::join(flags, " "), file, output.string()));
-            not res)
-            return cppxx::unexpected_move(res);
-    }
+    if (not w->bin)
+        w->bin = std::unordered_map<std::string, Target>{};
+    (*w->bin)[source] = Target{
+        .sources = std::vector<std::string>{source},
+        .flags = std::move(flags),
+        .link_flags = std::move(mode),
+        .depends_on = std::vector<std::string>(script->depends_on),
+        .pch = script->headers.empty() ? std::nullopt : std::optional(script->headers),
+    };
+
+    auto ccs = generate_compile_commands(*w, source);
+    if (not ccs)
+        return cppxx::unexpected_move(ccs);
 
-    args.insert(args.begin(), output.string());
-    const std::string cmd = fmt::format("{}", fmt::join(args, " "));
-    spdlog::info("running {:?}", cmd);
+    // the build log knows whether the script, the headers it includes and the libs are unchanged
+    const std::string output = (cache / "bin" / script->key() / fs::path(file).stem()).string();
+    const int jobs = std::max<int>(std::thread::hardware_concurrency(), 1);
+    return build(std::move(*ccs), jobs, output).transform([&]() { return output; });
+}
+
+std::expected<void, std::runtime_error> Run::exec() {
+    return compile().and_then([&](std::string &&output) {
+        args.insert(args.begin(), std::move(output));
+        const std::string cmd = fmt::format("{}", fmt::join(args, " "));
+        spdlog::info("running {:?}", cmd);
 
-    return system(cmd);
+        return system(cmd);
+    });
 }
@@ -0,0 +1,135 @@
+#include <fmt/ranges.h>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <atomic>
+#include <cppxx/multithreading/pool.h>
+#include <queue>
+#include "scheduler.h"
+#include "system.h"
+#include "trace.h"
+
+
+size_t Scheduler::add(Node node) {
+    nodes.push_back(std::move(node));
+    return nodes.size() - 1;
+}
+
+std::expected<void, std::runtime_error> Scheduler::run(int jobs, Jobserver *jobserver, std::stop_token stop) {
+    const size_t n = nodes.size();
+    std::vector<std::vector<size_t>> dependents(n);
+    std::vector<size_t> waiting(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        for (auto dep : nodes[i].deps) {
+            if (dep >= n)
+                return cppxx::unexpected_errorf("Node {:?} depends on an unknown node {}", nodes[i].name, dep);
+            dependents[dep].push_back(i);
+            ++waiting[i];
+        }
+    }
+
+    // priority = own cost + the most expensive chain of dependents, evaluated in reverse topological order
+    std::vector<int64_t> priority(n, 0);
+    std::vector<size_t> order, indegree = waiting;
+    for (size_t i = 0; i < n; ++i)
+        if (indegree[i] == 0)
+            order.push_back(i);
+    for (size_t k = 0; k < order.size(); ++k)
+        for (auto d : dependents[order[k]])
+            if (--indegree[d] == 0)
+                order.push_back(d);
+
+    if (order.size() != n)
+        return cppxx::unexpected_errorf("Build graph has a cycle");
+
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        int64_t longest = 0;
+        for (auto d : dependents[*it])
+            longest = std::max(longest, priority[d]);
+        priority[*it] = std::max<int64_t>(nodes[*it].cost, 1) + longest;
+    }
+
+    auto cmp = [&](size_t a, size_t b) { return priority[a] < priority[b]; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(cmp)> ready(cmp);
+    std::vector<Trace::Clock::time_point> ready_since(n, Trace::Clock::now());
+    for (size_t i = 0; i < n; ++i)
+        if (waiting[i] == 0)
+            ready.push(i);
+
+    // worker lanes of the trace, a node keeps its slot from dispatch until its result is collected
+    std::vector<int64_t> free_slots, slot_of(n, 0);
+    for (int64_t slot = std::max(jobs, 1); slot > 0; --slot)
+        free_slots.push_back(slot);
+
+    // the workers report to wherever the calling thread does
+    const auto sink = thread_sink();
+
+    // only hand as many nodes to the pool as there are workers, so that the priorities stay in charge
+    using Result = std::pair<size_t, std::expected<void, std::runtime_error>>;
+    cppxx::multithreading::Pool<Result> pool(jobs);
+    size_t running = 0;
+    std::optional<std::runtime_error> err = std::nullopt;
+
+    auto dispatch = [&]() {
+        for (; not err and not stop.stop_requested() and not ready.empty() and running < size_t(std::max(jobs, 1)); ++running) {
+            size_t i = ready.top();
+            ready.pop();
+            slot_of[i] = free_slots.back();
+            free_slots.pop_back();
+
+            pool << [this, i, jobserver, sink, stop, slot = slot_of[i], queued = ready_since[i]]() -> Result {
+                // the implicit slot of this process is free to take, any other job needs a token
+                std::optional<char> token;
+                bool own_implicit = not jobserver or jobserver->take_implicit();
+                if (not own_implicit) {
+                    auto acquired = jobserver->acquire(stop);
+                    if (not acquired)
+                        return {i, cppxx::unexpected_move(acquired)};
+                    token = *acquired;
+                }
+
+                cppxx::defer _ = [&]() {
+                    if (token)
+                        jobserver->release(*token);
+                    else if (jobserver)
+                        jobserver->release_implicit();
+                };
+
+                Trace::set_thread(slot);
+                set_thread_sink(sink);
+                const auto start = Trace::Clock::now();
+                auto res = nodes[i].run();
+                if (Trace::enabled()) {
+                    const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(start - queued).count();
+                    Trace::complete(nodes[i].name, nodes[i].category, start, Trace::Clock::now(), {
+                        {"queued_ms", rfl::Generic(waited / 1000.0)},
+                        {"ok", rfl::Generic(res.has_value())},
+                    });
+                }
+                return {i, std::move(res)};
+            };
+        }
+    };
+
+    for (dispatch(); running > 0; dispatch()) {
+        pool >> [&](Result &&res) {
+            --running;
+            free_slots.push_back(slot_of[res.first]);
+            if (not res.second) {
+                if (not err)
+                    err.emplace(std::move(res.second.error()));
+                return;
+            }
+            for (auto d : dependents[res.first])
+                if (--waiting[d] == 0) {
+                    ready_since[d] = Trace::Clock::now();
+                    ready.push(d);
+                }
+        };
+    }
+
+    if (err)
+        return std::unexpected(std::move(*err));
+    if (stop.stop_requested() and not ready.empty())
+        return cppxx::unexpected_errorf("Build was cancelled");
+    return {};
+}
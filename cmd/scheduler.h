@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <vector>
+#include "jobserver.h"
+
+
+// Runs a DAG of build steps (compile, archive, link, ...) on a bounded number of workers.
+// Among the nodes that are ready, the one heading the longest remaining path to any sink runs first
+// (critical path scheduling), so long-pole translation units start early instead of finishing last.
+class Scheduler {
+public:
+    struct Node {
+        std::string name;
+        std::function<std::expected<void, std::runtime_error>()> run;
+        std::vector<size_t> deps = {}; // nodes that must have finished before this one starts
+        int64_t cost = 1;              // estimated duration, e.g. from the build log
+        std::string category = "build"; // compile, archive, link, ... in the trace
+    };
+
+    size_t add(Node node);
+    void depend(size_t node, size_t dep) { nodes[node].deps.push_back(dep); }
+    size_t size() const { return nodes.size(); }
+
+    // stops scheduling new nodes after the first failure, but lets the running ones finish.
+    // With a jobserver, every node beyond the one in the implicit slot of the process holds a token while it runs.
+    // Once `stop` is requested nothing new is started either, it is up to the nodes to abort what is running
+    std::expected<void, std::runtime_error> run(int jobs, Jobserver *jobserver = nullptr, std::stop_token stop = {});
+
+private:
+    std::vector<Node> nodes;
+};
@@ -0,0 +1,159 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <rfl/json.hpp>
+#include <cppxx/error.h>
+#include <sha256.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "workspace.h"
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    constexpr std::string_view version = "cppxx snapshot v1";
+
+    struct Directory {
+        std::string path;
+        int64_t mtime = -1; // nanoseconds, -1 if it does not exist
+    };
+
+    struct Snapshot {
+        std::string key;
+        std::vector<Directory> globbed;
+        Workspace workspace;
+    };
+
+    int64_t mtime_of(const std::string &path) {
+        struct stat st;
+        if (::stat(path.c_str(), &st) < 0)
+            return -1;
+        return int64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+    }
+
+    // the config file, the requested scope, and the value of every `${NAME}` the config file mentions
+    std::optional<std::string> key_of(const std::string &root_dir, const std::string &scope) {
+        std::stringstream ss;
+        ss << version << '\n' << fs::current_path().string() << '\n' << root_dir << '\n' << scope << '\n';
+
+        std::string config;
+        for (const char *name : {"cppxx.toml", "cppxx.json"}) {
+            if (std::ifstream is(fs::path(root_dir) / name); is) {
+                std::stringstream content;
+                content << is.rdbuf();
+                config = content.str();
+                ss << name << '\n' << config << '\n';
+                break;
+            }
+        }
+        if (config.empty())
+            return std::nullopt;
+
+        std::set<std::string> names = {CPPXX_CACHE};
+        for (size_t pos = config.find("${"); pos != std::string::npos; pos = config.find("${", pos + 2)) {
+            const size_t end = config.find_first_not_of(
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_", pos + 2);
+            names.insert(config.substr(pos + 2, end - pos - 2));
+        }
+        for (const auto &name : names) {
+            const char *value = std::getenv(name.c_str());
+            ss << name << (value ? fmt::format("={}", value) : " unset") << '\n';
+        }
+
+        return SHA256::hashString(ss.str());
+    }
+
+    fs::path path_of(const std::string &key) {
+        const char *cache = std::getenv(CPPXX_CACHE);
+        return fs::path(cache ? cache : "") / "snapshots" / (key.substr(0, 16) + ".json");
+    }
+
+    // snapshots loaded or saved by this process, so that a long running one (the daemon) keeps its workspaces resident
+    std::mutex resident_mutex;
+    std::unordered_map<std::string, Snapshot> resident;
+
+    std::optional<Snapshot> read(const std::string &key) {
+        {
+            std::lock_guard lock(resident_mutex);
+            if (auto it = resident.find(key); it != resident.end())
+                return it->second;
+        }
+
+        std::ifstream is(path_of(key));
+        if (not is)
+            return std::nullopt;
+
+        auto snapshot = rfl::json::read<Snapshot>(is);
+        if (not snapshot or snapshot->key != key)
+            return std::nullopt;
+
+        std::lock_guard lock(resident_mutex);
+        return resident.insert_or_assign(key, std::move(*snapshot)).first->second;
+    }
+
+    std::optional<Workspace> load(const std::string &key) {
+        auto snapshot = read(key);
+        if (not snapshot)
+            return std::nullopt;
+
+        // a file added to or removed from a globbed directory changes its mtime
+        for (const auto &dir : snapshot->globbed)
+            if (mtime_of(dir.path) != dir.mtime) {
+                spdlog::debug("workspace snapshot is stale, {:?} changed", dir.path);
+                return std::nullopt;
+            }
+
+        snapshot->workspace.globbed() = {};
+        for (const auto &dir : snapshot->globbed)
+            snapshot->workspace.globbed().push_back(dir.path);
+        return std::move(snapshot->workspace);
+    }
+
+    std::expected<void, std::runtime_error> save(const std::string &key, const Workspace &w) {
+        Snapshot snapshot = {.key = key, .globbed = {}, .workspace = w};
+        for (const auto &dir : w.globbed())
+            snapshot.globbed.push_back({.path = dir, .mtime = mtime_of(dir)});
+        {
+            std::lock_guard lock(resident_mutex);
+            resident.insert_or_assign(key, snapshot);
+        }
+
+        const fs::path path = path_of(key);
+        const fs::path tmp = path.string() + fmt::format(".tmp-{}", ::getpid());
+        std::error_code ec;
+        fs::create_directories(path.parent_path(), ec);
+
+        if (std::ofstream os(tmp); not (os << rfl::json::write(snapshot)))
+            return cppxx::unexpected_errorf("Cannot write workspace snapshot {:?}", tmp.string());
+
+        if (fs::rename(tmp, path, ec); ec) {
+            fs::remove(tmp, ec);
+            return cppxx::unexpected_errorf("Cannot write workspace snapshot {:?}: {}", path.string(), ec.message());
+        }
+        return {};
+    }
+} // namespace
+
+std::expected<Workspace, std::runtime_error>
+resolve_cached(const std::string &root_dir,
+               const std::string &scope,
+               const std::function<std::expected<Workspace, std::runtime_error>()> &resolve) {
+    const auto key = std::getenv(CPPXX_CACHE) ? key_of(root_dir, scope) : std::nullopt;
+    if (key)
+        if (auto w = load(*key)) {
+            spdlog::debug("using the workspace snapshot {:?}", path_of(*key).string());
+            return std::move(*w);
+        }
+
+    auto w = resolve();
+    if (w and key)
+        if (auto saved = save(*key, *w); not saved)
+            spdlog::warn("{}", saved.error().what());
+    return w;
+}
@@ -0,0 +1,122 @@
+#include <fmt/ranges.h>
+#include <cppxx/error.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "socket.h"
+
+
+bool send_all(int fd, std::string_view data) {
+    while (not data.empty()) {
+        const ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+bool SocketReader::fill() {
+    char chunk[64 * 1024];
+    for (;;) {
+        const ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+}
+
+std::optional<std::string> SocketReader::line() {
+    size_t end;
+    while ((end = buffer.find('\n')) == std::string::npos)
+        if (not fill())
+            return std::nullopt;
+
+    std::string result = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return result;
+}
+
+std::optional<std::string> SocketReader::bytes(size_t size) {
+    while (buffer.size() < size)
+        if (not fill())
+            return std::nullopt;
+
+    std::string result = buffer.substr(0, size);
+    buffer.erase(0, size);
+    return result;
+}
+
+static std::expected<addrinfo *, std::runtime_error> resolve(const std::string &host, const std::string &port, int flags) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+
+    addrinfo *result = nullptr;
+    if (int err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result); err != 0)
+        return cppxx::unexpected_errorf("Cannot resolve {}:{}: {}", host, port, ::gai_strerror(err));
+    return result;
+}
+
+std::expected<int, std::runtime_error> connect_tcp(const std::string &host, const std::string &port) {
+    auto addresses = resolve(host, port, 0);
+    if (not addresses)
+        return cppxx::unexpected_move(addresses);
+
+    int err = 0;
+    for (addrinfo *ai = *addresses; ai; ai = ai->ai_next) {
+        const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            ::freeaddrinfo(*addresses);
+            // requests and replies are single writes each, don't let them wait for acks
+            const int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        err = errno;
+        ::close(fd);
+    }
+
+    ::freeaddrinfo(*addresses);
+    return cppxx::unexpected_errorf("Cannot connect to {}:{}: {}", host, port, std::strerror(err));
+}
+
+std::expected<int, std::runtime_error> listen_tcp(const std::string &host, const std::string &port) {
+    auto addresses = resolve(host, port, AI_PASSIVE);
+    if (not addresses)
+        return cppxx::unexpected_move(addresses);
+
+    int err = 0;
+    for (addrinfo *ai = *addresses; ai; ai = ai->ai_next) {
+        const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        const int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 and ::listen(fd, SOMAXCONN) == 0) {
+            ::freeaddrinfo(*addresses);
+            return fd;
+        }
+        err = errno;
+        ::close(fd);
+    }
+
+    ::freeaddrinfo(*addresses);
+    return cppxx::unexpected_errorf("Cannot listen on {}:{}: {}", host, port, std::strerror(err));
+}
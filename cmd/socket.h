@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+// Blocking helpers for the sockets of the daemon and the workers, whose messages are a JSON line followed by an
+// optional payload of the size announced in it
+
+// false if the peer is gone, never raises SIGPIPE
+bool send_all(int fd, std::string_view data);
+
+class SocketReader {
+public:
+    explicit SocketReader(int fd)
+        : fd(fd) {}
+
+    // up to the next newline, without it
+    std::optional<std::string> line();
+    // exactly `size` bytes
+    std::optional<std::string> bytes(size_t size);
+
+private:
+    bool fill();
+
+    int fd;
+    std::string buffer;
+};
+
+std::expected<int, std::runtime_error> connect_tcp(const std::string &host, const std::string &port);
+std::expected<int, std::runtime_error> listen_tcp(const std::string &host, const std::string &port);
@@ -1,13 +1,27 @@
 #include <fmt/ranges.h>
+#include <cppxx/defer.h>
 #include <cppxx/error.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <tuple>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "system.h"
 
+extern char **environ;
 
-std::expected<void, std::runtime_error> system(const std::string &cmd) {
-    if (int status = std::system(cmd.c_str()); status == -1)
-        return cppxx::unexpected_errorf("failed to run {:?}", cmd);
+namespace fs = std::filesystem;
 
-    else if (int res = WEXITSTATUS(status); WIFEXITED(status) and res != 0)
+
+static std::expected<void, std::runtime_error> check_status(const std::string &cmd, int status) {
+    if (int res = WEXITSTATUS(status); WIFEXITED(status) and res != 0)
         return cppxx::unexpected_errorf("{:?} exited with return code {}", cmd, res);
 
     else if (int sig = WTERMSIG(status); WIFSIGNALED(status))
@@ -15,3 +29,182 @@ std::expected<void, std::runtime_error> system(const std::string &cmd) {
 
     return {};
 }
+
+std::expected<void, std::runtime_error> system(const std::string &cmd) {
+    if (int status = std::system(cmd.c_str()); status == -1)
+        return cppxx::unexpected_errorf("failed to run {:?}", cmd);
+    else
+        return check_status(cmd, status);
+}
+
+std::expected<void, std::runtime_error>
+spawn(const std::vector<std::string> &args, const std::string &directory, bool quiet, std::stop_token stop) {
+    const std::string cmd = fmt::format("{}", fmt::join(args, " "));
+    if (args.empty())
+        return cppxx::unexpected_errorf("failed to run {:?}: empty command", cmd);
+
+    std::vector<char *> argv;
+    for (const auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) < 0)
+        return cppxx::unexpected_errorf("failed to run {:?}: {}", cmd, std::strerror(errno));
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    if (not directory.empty())
+        posix_spawn_file_actions_addchdir_np(&actions, directory.c_str());
+
+    // a cancellable child leads its own process group, so that it can be killed as a whole
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    if (stop.stop_possible()) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+
+    pid_t pid = 0;
+    int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(fds[1]);
+
+    if (err != 0) {
+        ::close(fds[0]);
+        return cppxx::unexpected_errorf("failed to run {:?}: {}", cmd, std::strerror(err));
+    }
+
+    // drain stderr before waiting, otherwise a chatty child blocks on a full pipe.
+    // The child is not reaped before the callback is gone, so its pid cannot be reused in the meantime
+    std::string captured;
+    {
+        std::stop_callback on_stop(stop, [pid]() { ::kill(-pid, SIGTERM); });
+        char buffer[4096];
+        for (ssize_t n; (n = ::read(fds[0], buffer, sizeof(buffer))) != 0;) {
+            if (n > 0)
+                captured.append(buffer, n);
+            else if (errno != EINTR)
+                break;
+        }
+    }
+    ::close(fds[0]);
+
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return cppxx::unexpected_errorf("failed to wait for {:?}: {}", cmd, std::strerror(errno));
+
+    if (stop.stop_requested())
+        return cppxx::unexpected_errorf("{:?} was cancelled", cmd);
+
+    if (not quiet and not captured.empty())
+        print_stderr(captured);
+
+    return check_status(cmd, status);
+}
+
+static thread_local std::shared_ptr<const Sink> current_sink;
+
+std::shared_ptr<const Sink> thread_sink() { return current_sink; }
+
+void set_thread_sink(std::shared_ptr<const Sink> sink) { current_sink = std::move(sink); }
+
+void print_stderr(std::string_view text) {
+    if (current_sink)
+        return (*current_sink)(text);
+    std::ignore = ::write(STDERR_FILENO, text.data(), text.size());
+}
+
+std::vector<std::string> split_args(const std::string &cmd) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool in_arg = false;
+    char quote = '\0';
+
+    for (size_t i = 0; i < cmd.size(); ++i) {
+        const char c = cmd[i];
+        if (quote == '\'') {
+            if (c == '\'')
+                quote = '\0';
+            else
+                arg += c;
+        } else if (quote == '"') {
+            if (c == '"')
+                quote = '\0';
+            else if (c == '\\' and i + 1 < cmd.size() and std::strchr("\"\\$`", cmd[i + 1]))
+                arg += cmd[++i];
+            else
+                arg += c;
+        } else if (c == '\'' or c == '"') {
+            quote = c;
+            in_arg = true;
+        } else if (c == '\\' and i + 1 < cmd.size()) {
+            arg += cmd[++i];
+            in_arg = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (in_arg)
+                args.push_back(std::move(arg));
+            arg.clear();
+            in_arg = false;
+        } else {
+            arg += c;
+            in_arg = true;
+        }
+    }
+
+    if (in_arg)
+        args.push_back(std::move(arg));
+
+    return args;
+}
+
+std::expected<void, std::runtime_error>
+populate_once(const std::string &dest, const std::function<std::expected<void, std::runtime_error>(const std::string &tmp)> &fill) {
+    const std::string done = dest + ".done";
+    if (fs::exists(done) and fs::exists(dest))
+        return {};
+
+    std::error_code ec;
+    fs::create_directories(fs::path(dest).parent_path(), ec);
+    if (ec)
+        return cppxx::unexpected_errorf("Failed to create the parent of {:?}: {}", dest, ec.message());
+
+    const std::string lock_path = dest + ".lock";
+    const int fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return cppxx::unexpected_errorf("Failed to open {:?}: {}", lock_path, std::strerror(errno));
+    cppxx::defer _ = [&]() { ::close(fd); };
+
+    while (::flock(fd, LOCK_EX) < 0)
+        if (errno != EINTR)
+            return cppxx::unexpected_errorf("Failed to lock {:?}: {}", lock_path, std::strerror(errno));
+
+    // someone else may have finished it while we were waiting for the lock
+    if (fs::exists(done) and fs::exists(dest))
+        return {};
+
+    fs::remove_all(dest, ec);
+    fs::remove(done, ec);
+
+    const std::string tmp = fmt::format("{}.tmp-{}-{}", dest, ::getpid(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    fs::remove_all(tmp, ec);
+
+    if (auto res = fill(tmp); not res) {
+        fs::remove_all(tmp, ec);
+        return res;
+    }
+
+    fs::rename(tmp, dest, ec);
+    if (ec) {
+        fs::remove_all(tmp, ec);
+        return cppxx::unexpected_errorf("Failed to move {:?} into place: {}", dest, ec.message());
+    }
+
+    if (std::ofstream os(done); not (os << '\n'))
+        return cppxx::unexpected_errorf("Failed to mark {:?} as complete", dest);
+
+    return {};
+}
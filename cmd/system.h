@@ -2,7 +2,37 @@
 
 #include <cstdlib>
 #include <expected>
+#include <functional>
+#include <memory>
 #include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
 
 
 std::expected<void, std::runtime_error> system(const std::string &cmd);
+
+// Run `args` directly via posix_spawn, without a shell, after changing into `directory` (if not empty).
+// The stderr of the child is captured and printed as one block, or discarded if `quiet`.
+// Requesting `stop` terminates the child together with everything it started, e.g. cc1plus under the gcc driver
+std::expected<void, std::runtime_error> spawn(const std::vector<std::string> &args,
+                                              const std::string &directory = "",
+                                              bool quiet = false,
+                                              std::stop_token stop = {});
+
+// The output of spawned commands and the log go to stderr, unless the calling thread redirects them, e.g. the daemon
+// to the client it is building for. The scheduler hands the redirection of its caller on to its workers
+using Sink = std::function<void(std::string_view)>;
+std::shared_ptr<const Sink> thread_sink();
+void set_thread_sink(std::shared_ptr<const Sink> sink);
+void print_stderr(std::string_view text);
+
+// Split a command line into arguments, honoring quotes and backslash escapes like /bin/sh does for plain words
+std::vector<std::string> split_args(const std::string &cmd);
+
+// Create `dest` in the shared cache exactly once, even with concurrent cppxx processes: `fill` writes into a
+// temporary sibling, which is renamed into place while holding an advisory lock on `<dest>.lock`.
+// A `<dest>.done` marker is written last, so a half-written `dest` left by a crash is discarded and redone
+std::expected<void, std::runtime_error>
+populate_once(const std::string &dest, const std::function<std::expected<void, std::runtime_error>(const std::string &tmp)> &fill);
@@ -17,4 +17,11 @@ struct Target {
     std::optional<std::variant<Extended, std::vector<std::string>>> flags = std::nullopt;
     std::optional<std::vector<std::string>> link_flags = std::nullopt;
     std::optional<std::variant<Extended, std::vector<std::string>>> depends_on = std::nullopt;
+    std::optional<bool> dynamic = std::nullopt; // lib targets only: build a shared instead of a static library
+    std::optional<bool> unity = std::nullopt;   // compile the sources in batches, each batch as one translation unit
+    std::optional<int> unity_batch = std::nullopt; // average number of sources per batch, implies `unity`, defaults to 8
+    std::optional<std::vector<std::string>> pch = std::nullopt; // headers to precompile, as written in `#include <...>`
+    std::optional<bool> modules = std::nullopt; // scan the sources for C++20 modules and compile them in import order
+    std::optional<std::string> linker = std::nullopt; // overrides the `linker` of the workspace for this target
+    std::optional<std::string> lto = std::nullopt;    // overrides the `lto` of the workspace for this target
 };
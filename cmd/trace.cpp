@@ -0,0 +1,149 @@
+#include <fmt/ranges.h>
+#include <rfl/json.hpp>
+#include <spdlog/spdlog.h>
+#include <cppxx/error.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <ranges>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include "trace.h"
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    struct State {
+        std::atomic_bool enabled = false;
+        const Trace::Clock::time_point epoch = Trace::Clock::now();
+        std::mutex mutex;
+        std::vector<Trace::Event> events;
+        std::unordered_map<std::string, std::pair<int64_t, int64_t>> headers; // total parse time and count
+    };
+
+    State &state() {
+        static State s;
+        return s;
+    }
+
+    thread_local int64_t thread_id = 0;
+
+    int64_t micros(Trace::Clock::time_point t) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - state().epoch).count();
+    }
+
+    struct TimeTrace {
+        std::vector<Trace::Event> traceEvents;
+    };
+} // namespace
+
+void Trace::enable() { state().enabled = true; }
+
+bool Trace::enabled() { return state().enabled; }
+
+void Trace::set_thread(int64_t tid) { thread_id = tid; }
+
+void Trace::complete(std::string name, std::string cat, Clock::time_point start, Clock::time_point end,
+                     std::map<std::string, rfl::Generic> args) {
+    if (not enabled())
+        return;
+
+    Event e = {
+        .name = std::move(name),
+        .cat = std::move(cat),
+        .ts = micros(start),
+        .dur = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+        .tid = thread_id,
+        .args = std::move(args),
+    };
+
+    std::lock_guard lock(state().mutex);
+    state().events.push_back(std::move(e));
+}
+
+void Trace::merge_time_trace(const std::string &path, Clock::time_point start) {
+    if (not enabled())
+        return;
+
+    std::ifstream is(path);
+    if (not is)
+        return;
+
+    std::stringstream ss;
+    ss << is.rdbuf();
+    is.close();
+    std::error_code ec;
+    fs::remove(path, ec);
+
+    auto trace = rfl::json::read<TimeTrace, rfl::DefaultIfMissing>(ss.str());
+    if (not trace) {
+        spdlog::warn("Cannot parse time trace {:?}: {}", path, trace.error().what());
+        return;
+    }
+
+    // clang timestamps are relative to the start of its own process; its "Total" summaries are skipped
+    const int64_t offset = micros(start);
+    std::vector<Event> events;
+    std::unordered_map<std::string, int64_t> headers;
+    for (auto &e : trace->traceEvents) {
+        if (e.ph != "X" or e.name.starts_with("Total "))
+            continue;
+
+        if (auto detail = e.args.find("detail"); e.name == "Source" and detail != e.args.end())
+            if (auto header = detail->second.to_string())
+                headers[*header] += e.dur;
+
+        e.cat = "time-trace";
+        e.ts += offset;
+        e.pid = 1;
+        e.tid = thread_id;
+        events.push_back(std::move(e));
+    }
+
+    std::lock_guard lock(state().mutex);
+    std::ranges::move(events, std::back_inserter(state().events));
+    for (const auto &[header, dur] : headers) {
+        auto &[total, count] = state().headers[header];
+        total += dur;
+        count += 1;
+    }
+}
+
+std::expected<void, std::runtime_error> Trace::save(const std::string &path) {
+    std::lock_guard lock(state().mutex);
+    auto &events = state().events;
+
+    // name the lanes, so the viewer shows "main" and "worker N" instead of bare ids
+    std::unordered_set<int64_t> tids;
+    for (const auto &e : events)
+        tids.insert(e.tid);
+    for (auto tid : tids)
+        events.push_back({
+            .name = "thread_name",
+            .ph = "M",
+            .tid = tid,
+            .args = {{"name", rfl::Generic(tid == 0 ? std::string("main") : fmt::format("worker {}", tid))}},
+        });
+
+    std::ofstream os(path);
+    if (not os)
+        return cppxx::unexpected_errorf("Cannot write trace {:?}", path);
+
+    os << rfl::json::write(TimeTrace{.traceEvents = events});
+    spdlog::info("trace is written to {:?}", path);
+
+    if (state().headers.empty())
+        return {};
+
+    std::vector<std::pair<std::string, std::pair<int64_t, int64_t>>> headers(state().headers.begin(), state().headers.end());
+    std::ranges::sort(headers, std::greater{}, [](const auto &h) { return h.second.first; });
+    spdlog::info("slowest headers:");
+    for (const auto &[header, stats] : headers | std::views::take(10))
+        spdlog::info("  {:>8.1f} ms in {:>3} TUs  {}", stats.first / 1000.0, stats.second, header);
+
+    return {};
+}
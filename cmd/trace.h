@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <map>
+#include <rfl.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// Build timeline in the Chrome trace event format, to be opened with chrome://tracing or https://ui.perfetto.dev.
+// Recording is process wide and does nothing until `Trace::enable()` is called, so the pipeline can be traced freely.
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        std::string name;
+        std::string cat = "";
+        std::string ph = "X";
+        int64_t ts = 0; // microseconds since cppxx started
+        int64_t dur = 0;
+        int64_t pid = 1;
+        int64_t tid = 0; // 0 is the main thread, workers are numbered from 1
+        std::map<std::string, rfl::Generic> args = {};
+    };
+
+    static void enable();
+    static bool enabled();
+
+    // lane of the events recorded by the calling thread, set by the scheduler for its workers
+    static void set_thread(int64_t tid);
+
+    static void complete(std::string name, std::string cat, Clock::time_point start, Clock::time_point end,
+                         std::map<std::string, rfl::Generic> args = {});
+
+    // merge the `-ftime-trace` output of a clang compile started at `start` below its compile event,
+    // and add its "Source" events to the per-header totals
+    static void merge_time_trace(const std::string &path, Clock::time_point start);
+
+    // write the trace file and log the headers that took the longest to parse
+    static std::expected<void, std::runtime_error> save(const std::string &path);
+
+    // records the enclosing scope as a complete event
+    class Scope {
+    public:
+        Scope(std::string name, std::string cat)
+            : name(std::move(name))
+            , cat(std::move(cat))
+            , start(Clock::now()) {}
+
+        ~Scope() {
+            if (enabled())
+                complete(std::move(name), std::move(cat), start, Clock::now());
+        }
+
+    private:
+        std::string name, cat;
+        Clock::time_point start;
+    };
+};
@@ -0,0 +1,139 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <cppxx/error.h>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "watch.h"
+
+
+static bool is_temporary(std::string_view name) {
+    return name.starts_with('.') or name.ends_with('~') or name.ends_with(".swp") or name.ends_with(".swx") or name == "4913";
+}
+
+std::expected<Watcher, std::runtime_error> Watcher::New() {
+    const int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return cppxx::unexpected_errorf("Cannot initialize inotify: {}", std::strerror(errno));
+    return Watcher(fd);
+}
+
+Watcher::Watcher(Watcher &&other) noexcept
+    : fd(std::exchange(other.fd, -1))
+    , wds(std::move(other.wds))
+    , dirs(std::move(other.dirs)) {}
+
+Watcher::~Watcher() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void Watcher::watch(const std::set<std::string> &next) {
+    for (auto it = wds.begin(); it != wds.end();) {
+        if (next.contains(it->first)) {
+            ++it;
+            continue;
+        }
+        ::inotify_rm_watch(fd, it->second);
+        dirs.erase(it->second);
+        it = wds.erase(it);
+    }
+
+    constexpr uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    for (const auto &dir : next) {
+        if (wds.contains(dir))
+            continue;
+
+        const int wd = ::inotify_add_watch(fd, dir.c_str(), mask);
+        if (wd < 0) {
+            if (errno == ENOSPC)
+                spdlog::warn("Cannot watch {:?}: too many watches, raise fs.inotify.max_user_watches", dir);
+            else if (errno != ENOENT and errno != ENOTDIR)
+                spdlog::warn("Cannot watch {:?}: {}", dir, std::strerror(errno));
+            continue;
+        }
+        wds.emplace(dir, wd);
+        dirs.emplace(wd, dir);
+    }
+}
+
+std::expected<bool, std::runtime_error> Watcher::read(Changes &changes) {
+    bool any = false;
+    alignas(inotify_event) char buffer[64 * 1024];
+
+    for (;;) {
+        const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n < 0 and errno == EAGAIN)
+            return any;
+        if (n <= 0)
+            return cppxx::unexpected_errorf("Cannot read inotify events: {}", std::strerror(errno));
+
+        for (ssize_t offset = 0; offset < n;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changes.overflow = any = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // the directory itself was removed
+                if (auto it = dirs.find(event->wd); it != dirs.end()) {
+                    changes.removed.insert(it->second);
+                    wds.erase(it->second);
+                    dirs.erase(it);
+                    any = true;
+                }
+                continue;
+            }
+
+            auto dir = dirs.find(event->wd);
+            if (dir == dirs.end() or event->len == 0 or is_temporary(event->name))
+                continue;
+
+            const std::string path = dir->second + '/' + event->name;
+            any = true;
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                changes.removed.erase(path);
+                changes.created.insert(path);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                // a temporary that was created and removed again within this batch never existed
+                if (changes.created.erase(path) == 0)
+                    changes.removed.insert(path);
+                changes.written.erase(path);
+            } else if (event->mask & IN_CLOSE_WRITE) {
+                changes.written.insert(path);
+            }
+        }
+    }
+}
+
+std::expected<Watcher::Changes, std::runtime_error> Watcher::wait(std::chrono::milliseconds timeout, std::chrono::milliseconds quiet) {
+    Changes changes;
+    pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+
+    // a steady stream of writes should not postpone the rebuild forever
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    for (auto wait = timeout; std::chrono::steady_clock::now() < deadline; wait = quiet) {
+        const int ready = ::poll(&pfd, 1, int(wait.count()));
+        if (ready < 0 and errno == EINTR)
+            continue;
+        if (ready < 0)
+            return cppxx::unexpected_errorf("Cannot wait for inotify events: {}", std::strerror(errno));
+        if (ready == 0)
+            break;
+
+        auto res = read(changes);
+        if (not res)
+            return cppxx::unexpected_move(res);
+        if (*res and deadline == std::chrono::steady_clock::time_point::max())
+            deadline = std::chrono::steady_clock::now() + std::max(20 * quiet, std::chrono::milliseconds(1000));
+    }
+
+    return changes;
+}
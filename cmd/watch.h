@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <expected>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+
+// Reports changes to the files of a set of directories, on top of inotify.
+// Temporaries of editors (dotfiles, `foo~`, vim's `4913` probe) are ignored, and a file that is created and removed
+// again within one batch (write to a temporary, then rename over the original) does not show up at all
+class Watcher {
+public:
+    static std::expected<Watcher, std::runtime_error> New();
+
+    Watcher(Watcher &&other) noexcept;
+    Watcher &operator=(Watcher &&) = delete;
+    ~Watcher();
+
+    struct Changes {
+        std::set<std::string> written, created, removed; // absolute paths
+        bool overflow = false; // the kernel dropped events, anything may have changed
+
+        bool empty() const { return written.empty() and created.empty() and removed.empty() and not overflow; }
+    };
+
+    // replace the watched directories, those that do not exist (anymore) are skipped
+    void watch(const std::set<std::string> &dirs);
+    size_t size() const { return wds.size(); }
+
+    // wait up to `timeout` for the first change, then keep collecting until nothing happened for `quiet`,
+    // so that the burst of events of a single save results in a single batch. Empty if nothing changed
+    std::expected<Changes, std::runtime_error> wait(std::chrono::milliseconds timeout,
+                                                    std::chrono::milliseconds quiet = std::chrono::milliseconds(50));
+
+private:
+    explicit Watcher(int fd)
+        : fd(fd) {}
+
+    // read the pending events into `changes`, returns whether there were any
+    std::expected<bool, std::runtime_error> read(Changes &changes);
+
+    int fd = -1;
+    std::unordered_map<std::string, int> wds;
+    std::unordered_map<int, std::string> dirs;
+};
@@ -0,0 +1,289 @@
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+#include <rfl/json.hpp>
+#include <cppxx/defer.h>
+#include <cppxx/error.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ranges>
+#include <semaphore>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "worker.h"
+#include "options.h"
+#include "socket.h"
+#include "system.h"
+
+namespace fs = std::filesystem;
+
+
+// The client sends a Job line followed by `size` bytes of preprocessed source,
+// the worker answers with a Result line followed by `size` bytes of object
+namespace {
+    struct Job {
+        std::string command; // compiler and flags, without inputs and outputs
+        std::string suffix;  // `.i` for C, `.ii` for C++
+        size_t size = 0;
+    };
+
+    struct Result {
+        int status = 0; // 0 compiled, 1 the compiler failed, 2 the worker could not run the job
+        std::string output = "", error = "";
+        size_t size = 0;
+    };
+
+    constexpr auto retry_after = std::chrono::seconds(30);
+
+    constexpr size_t max_size = size_t(1) << 28; // of a preprocessed unit, bounds what a client can make a worker allocate
+
+    // whether `arg` is one of the flags cppxx passes to the compiler, and neither reads nor writes files of the host.
+    // Paths are only accepted where they cannot matter for a preprocessed unit (`-I`), or not at all
+    bool is_accepted(std::string_view arg) {
+        constexpr std::string_view exact[] = {"-pthread", "-pedantic", "-pedantic-errors", "-w", "-ansi"};
+        if (std::ranges::find(exact, arg) != std::end(exact))
+            return true;
+
+        // a macro or an include directory, the source is already preprocessed
+        for (std::string_view prefix : {"-D", "-U", "-I"})
+            if (arg.starts_with(prefix) and arg.size() > prefix.size())
+                return true;
+
+        // the language standard, warnings, optimization, debug info, code generation and target options, without a
+        // path as their value. `-Wa,`, `-Wp,` and `-Wl,` pass options on to other tools, plugins are loaded from disk
+        const bool known = arg.starts_with("-std=") or arg.starts_with("-f") or arg.starts_with("-W") or arg.starts_with("-O")
+            or arg.starts_with("-g") or arg.starts_with("-m");
+        if (not known or arg.starts_with("-Wa,") or arg.starts_with("-Wp,") or arg.starts_with("-Wl,") or arg.starts_with("-fplugin"))
+            return false;
+        const size_t eq = arg.find('=');
+        return eq == std::string_view::npos or arg.find_first_of("/@", eq) == std::string_view::npos;
+    }
+
+    // only known compilers with the flags of is_accepted, the worker runs whatever reaches it
+    std::expected<void, std::runtime_error> check(const std::vector<std::string> &args) {
+        if (args.empty())
+            return cppxx::unexpected_errorf("Empty command");
+
+        // versioned and cross compilers like g++-13 or aarch64-linux-gnu-gcc
+        std::string name = fs::path(args[0]).filename().string();
+        while (not name.empty() and (std::isdigit(uint8_t(name.back())) or name.back() == '.'))
+            name.pop_back();
+        if (name.ends_with('-'))
+            name.pop_back();
+
+        constexpr std::string_view compilers[] = {"c++", "g++", "gcc", "cc", "clang", "clang++"};
+        if (std::ranges::none_of(compilers, [&](std::string_view c) { return name == c or name.ends_with(fmt::format("-{}", c)); }))
+            return cppxx::unexpected_errorf("Compiler {:?} is not accepted", args[0]);
+
+        for (const auto &arg : args | std::views::drop(1))
+            if (not is_accepted(arg))
+                return cppxx::unexpected_errorf("Option {:?} is not accepted", arg);
+
+        return {};
+    }
+
+    void serve(int fd, std::counting_semaphore<> &slots) {
+        cppxx::defer _ = [fd]() { ::close(fd); };
+        auto reply = [fd](const Result &result, std::string_view object = {}) {
+            send_all(fd, rfl::json::write(result) + '\n') and send_all(fd, object);
+        };
+
+        SocketReader reader(fd);
+        auto line = reader.line();
+        if (not line)
+            return;
+        auto job = rfl::json::read<Job>(*line);
+        if (not job)
+            return reply({.status = 2, .error = fmt::format("Invalid job: {}", job.error().what())});
+        if (job->size > max_size)
+            return reply({.status = 2, .error = fmt::format("The unit of {} bytes exceeds the limit of {} bytes", job->size, max_size)});
+        auto source = reader.bytes(job->size);
+        if (not source)
+            return;
+
+        auto args = split_args(job->command);
+        if (auto checked = check(args); not checked)
+            return reply({.status = 2, .error = checked.error().what()});
+        if (job->suffix != ".i" and job->suffix != ".ii")
+            return reply({.status = 2, .error = fmt::format("Invalid suffix {:?}", job->suffix)});
+
+        slots.acquire();
+        cppxx::defer release = [&]() { slots.release(); };
+
+        std::string dir = (fs::temp_directory_path() / "cppxx-worker-XXXXXX").string();
+        if (not ::mkdtemp(dir.data()))
+            return reply({.status = 2, .error = fmt::format("Cannot create a temporary directory: {}", std::strerror(errno))});
+        cppxx::defer cleanup = [&]() {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        };
+
+        const std::string unit = "unit" + job->suffix;
+        if (std::ofstream os(fs::path(dir) / unit, std::ios::binary); not (os << *source))
+            return reply({.status = 2, .error = "Cannot write the translation unit"});
+
+        // the diagnostics go back to the client
+        std::string output;
+        set_thread_sink(std::make_shared<const Sink>([&output](std::string_view text) { output += text; }));
+        args.insert(args.end(), {"-c", unit, "-o", "unit.o"});
+        auto res = spawn(args, dir);
+        set_thread_sink(nullptr);
+
+        if (not res) {
+            const std::string what = res.error().what();
+            return reply({.status = what.starts_with("failed to run") ? 2 : 1, .output = output, .error = what});
+        }
+
+        std::ifstream is(fs::path(dir) / "unit.o", std::ios::binary);
+        std::stringstream object;
+        object << is.rdbuf();
+        const std::string data = object.str();
+        reply({.status = 0, .output = output, .size = data.size()}, data);
+    }
+} // namespace
+
+Workers Workers::from_env() {
+    Workers workers;
+    const char *env = std::getenv("CPPXX_WORKERS");
+    if (not env)
+        return workers;
+
+    std::string spec;
+    std::istringstream ss(env);
+    while (std::getline(ss, spec, ',')) {
+        std::istringstream words(spec);
+        for (std::string word; words >> word;) {
+            int slots = 4;
+            if (size_t slash = word.find('/'); slash != std::string::npos) {
+                slots = std::atoi(word.c_str() + slash + 1);
+                word.resize(slash);
+            }
+
+            // `[::1]:3633` for IPv6
+            const size_t colon = word.rfind(':');
+            std::string host = word.substr(0, colon), port = colon == std::string::npos ? "" : word.substr(colon + 1);
+            if (host.starts_with('[') and host.ends_with(']'))
+                host = host.substr(1, host.size() - 2);
+
+            if (host.empty() or port.empty() or slots <= 0) {
+                spdlog::warn("Ignoring invalid worker {:?} in {:?}", word, "CPPXX_WORKERS");
+                continue;
+            }
+            workers.endpoints.emplace_back(std::move(host), std::move(port), slots);
+        }
+    }
+
+    return workers;
+}
+
+Workers::Endpoint *Workers::acquire() {
+    const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    for (auto &endpoint : endpoints) {
+        if (endpoint.down_until > now)
+            continue;
+        for (int busy = endpoint.busy; busy < endpoint.slots;)
+            if (endpoint.busy.compare_exchange_weak(busy, busy + 1))
+                return &endpoint;
+    }
+    return nullptr;
+}
+
+std::optional<std::expected<void, std::runtime_error>>
+Workers::compile(const CompileCommand &cc, const std::string &source, const std::string &object, std::stop_token stop) {
+    // a worker would reject the command anyway
+    if (not check(split_args(cc.base_command())))
+        return std::nullopt;
+
+    Endpoint *endpoint = acquire();
+    if (not endpoint)
+        return std::nullopt;
+    cppxx::defer _ = [&]() { --endpoint->busy; };
+
+    const std::string name = fmt::format("{}:{}", endpoint->host, endpoint->port);
+    auto unavailable = [&](const std::string &why) -> std::optional<std::expected<void, std::runtime_error>> {
+        if (stop.stop_requested())
+            return cppxx::unexpected_errorf("Compiling {:?} on {} was cancelled", cc.file, name);
+
+        spdlog::warn("Worker {} is unavailable, compiling locally for the next {}s: {}", name, retry_after.count(), why);
+        endpoint->down_until = (std::chrono::steady_clock::now() + retry_after).time_since_epoch().count();
+        return std::nullopt;
+    };
+
+    std::ifstream is(source, std::ios::binary);
+    std::stringstream ss;
+    ss << is.rdbuf();
+    const std::string data = ss.str();
+
+    auto fd = connect_tcp(endpoint->host, endpoint->port);
+    if (not fd)
+        return unavailable(fd.error().what());
+    cppxx::defer close = [&]() { ::close(*fd); };
+    std::stop_callback cancel(stop, [&]() { ::shutdown(*fd, SHUT_RDWR); });
+
+    const std::string suffix = fs::path(cc.file).extension() == ".c" ? ".i" : ".ii";
+    const Job job = {.command = cc.base_command(), .suffix = suffix, .size = data.size()};
+    if (not send_all(*fd, rfl::json::write(job) + '\n') or not send_all(*fd, data))
+        return unavailable("connection lost");
+
+    SocketReader reader(*fd);
+    auto line = reader.line();
+    if (not line)
+        return unavailable("connection lost");
+    auto result = rfl::json::read<Result>(*line);
+    if (not result)
+        return unavailable(fmt::format("invalid reply: {}", result.error().what()));
+
+    if (not result->output.empty())
+        print_stderr(result->output);
+    if (result->status == 2)
+        return unavailable(result->error);
+    if (result->status != 0)
+        return cppxx::unexpected_errorf("Failed to compile {:?} on {}: {}", cc.file, name, result->error);
+
+    auto compiled = reader.bytes(result->size);
+    if (not compiled)
+        return unavailable("connection lost");
+
+    const std::string tmp = object + ".tmp";
+    if (std::ofstream os(tmp, std::ios::binary); not (os << *compiled))
+        return cppxx::unexpected_errorf("Cannot write {:?}", tmp);
+
+    std::error_code ec;
+    if (fs::rename(tmp, object, ec); ec)
+        return cppxx::unexpected_errorf("Cannot write {:?}: {}", object, ec.message());
+
+    spdlog::debug("{:?} is compiled on {}", cc.file, name);
+    return std::expected<void, std::runtime_error>{};
+}
+
+std::expected<void, std::runtime_error> Worker::exec() {
+    const std::string host = listen.value_or("127.0.0.1"), service = std::to_string(port.value_or(3633));
+    auto server = listen_tcp(host, service);
+    if (not server)
+        return cppxx::unexpected_move(server);
+    cppxx::defer _ = [&]() { ::close(*server); };
+
+    // a client that disconnects early must not take the worker down
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int n = jobs.value_or(std::max<int>(std::thread::hardware_concurrency(), 1));
+    std::counting_semaphore<> slots(n);
+
+    spdlog::info("compiling for clients of {}:{} with {} jobs", host, service, n);
+    for (;;) {
+        const int client = ::accept4(*server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0 and (errno == EINTR or errno == ECONNABORTED))
+            continue;
+        if (client < 0)
+            return cppxx::unexpected_errorf("Cannot accept a client on {}:{}: {}", host, service, std::strerror(errno));
+
+        std::thread(serve, client, std::ref(slots)).detach();
+    }
+}
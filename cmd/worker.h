@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include "compile_command.h"
+
+
+// Distributed compilation in the spirit of distcc: translation units are preprocessed locally, and `cppxx worker`
+// agents receive the preprocessed source and the compiler flags over TCP, compile it and send the object back.
+//
+// `$CPPXX_WORKERS` lists the agents in order of preference as `host:port[/slots]` separated by spaces or commas,
+// e.g. `CPPXX_WORKERS="localhost:3633/4 buildbox:3633/16"` (4 slots if omitted). A unit only goes to a worker with a
+// free slot, so the local machine keeps compiling whatever the workers have no room for, and `-j` should cover both.
+class Workers {
+public:
+    static Workers from_env();
+
+    bool empty() const { return endpoints.empty(); }
+
+    // compile `cc` from its preprocessed `source` into `object` on a worker. Returns nullopt if no worker has a free
+    // slot or the chosen one cannot be reached, the unit has to be compiled locally then
+    std::optional<std::expected<void, std::runtime_error>>
+    compile(const CompileCommand &cc, const std::string &source, const std::string &object, std::stop_token stop);
+
+private:
+    struct Endpoint {
+        Endpoint(std::string host, std::string port, int slots)
+            : host(std::move(host))
+            , port(std::move(port))
+            , slots(slots) {}
+
+        std::string host, port;
+        int slots;
+        std::atomic_int busy = 0;
+        std::atomic<int64_t> down_until = 0; // steady clock ticks, a worker that failed is skipped for a while
+    };
+
+    Endpoint *acquire();
+
+    std::deque<Endpoint> endpoints;
+};
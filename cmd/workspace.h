@@ -1,14 +1,21 @@
 #pragma once
 
+#include <functional>
+#include <stop_token>
 #include "target.h"
 #include "compile_command.h"
 
 #define CPPXX_CACHE "CPPXX_CACHE"
 
+class BuildLog;
+class Jobserver;
+
 struct Workspace {
     std::string title = "", version = "", compiler = "";
     std::variant<std::string, int> standard = "";
     std::string author = "";
+    std::optional<std::string> linker = std::nullopt; // mold, lld, gold or bfd, the default of the compiler if omitted
+    std::optional<std::string> lto = std::nullopt;    // full or thin
     std::optional<std::unordered_map<std::string, std::string>> vars = std::nullopt;
     std::optional<std::unordered_map<std::string, Target>> interface = std::nullopt;
     std::optional<std::unordered_map<std::string, Target>> lib = std::nullopt;
@@ -17,13 +24,35 @@ struct Workspace {
     static std::expected<Workspace, std::runtime_error> New(const std::string &root_dir = "");
 
     rfl::Skip<std::unordered_map<std::string, std::string>> populated = {};
+    rfl::Skip<std::vector<std::string>> globbed = {}; // directories listed by resolve_paths
 };
 
 std::expected<Workspace, std::runtime_error> resolve_vars(Workspace &&);
 std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&, const std::string &target);
+std::expected<Workspace, std::runtime_error> resolve_target(Workspace &&, const std::vector<std::string> &targets);
 std::expected<Workspace, std::runtime_error> resolve_remotes(Workspace &&);
 std::expected<Workspace, std::runtime_error> resolve_paths(Workspace &&);
 
-std::expected<CompileCommands, std::runtime_error> generate_compile_commands(const Workspace &, const std::string &target);
+// Reuse the workspace resolved by `resolve` for `scope` (the requested targets) from a snapshot in $CPPXX_CACHE,
+// as long as the config file, the environment variables it references and the globbed directories are unchanged
+std::expected<Workspace, std::runtime_error>
+resolve_cached(const std::string &root_dir,
+               const std::string &scope,
+               const std::function<std::expected<Workspace, std::runtime_error>()> &resolve);
+
+// `for_build` batches the sources of unity targets and precompiles their `pch` headers, tools reading
+// compile_commands.json need every source and the plain headers instead
+std::expected<CompileCommands, std::runtime_error>
+generate_compile_commands(const Workspace &, const std::string &target, bool for_build = true);
 std::expected<void, std::runtime_error> build(CompileCommands &&, int jobs, const std::string &out);
+std::expected<void, std::runtime_error> build(std::vector<std::pair<std::string, CompileCommands>> &&outputs, int jobs);
+// The same with a build log and jobserver that outlive a single build, as in `cppxx build --watch`.
+// Requesting `stop` cancels the build, killing the commands that are still running
+std::expected<void, std::runtime_error> build(std::vector<std::pair<std::string, CompileCommands>> &&outputs,
+                                              int jobs,
+                                              BuildLog &log,
+                                              Jobserver *jobserver,
+                                              std::stop_token stop);
+// Let every following build share one build log and jobserver, as the daemon does for the builds of all its clients
+void share_build_state(int jobs);
 std::expected<void, std::runtime_error> build_single(CompileCommands &&, const std::string &out);
@@ -0,0 +1,107 @@
+#ifndef CPPXX_MULTITHREADING_POOL_H
+#define CPPXX_MULTITHREADING_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+
+namespace cppxx::multithreading {
+    /// Same interface as `Channel`, but backed by a fixed set of worker threads that live as long as the pool
+    /// instead of one thread per task. Results are received in completion order.
+    template <typename T>
+    class Pool {
+    public:
+        static_assert(!std::is_reference_v<T>, "T must not be a reference type");
+
+        explicit Pool(int n) {
+            for (int i = 0; i < std::max(n, 1); ++i)
+                workers.emplace_back([this](std::stop_token st) { work(st); });
+        }
+
+        ~Pool() {
+            {
+                std::lock_guard lock(mutex);
+                for (auto &w : workers)
+                    w.request_stop();
+            }
+            cv_tasks.notify_all();
+        }
+
+        template <typename F>
+            requires std::invocable<F> && std::same_as<std::invoke_result_t<F>, T>
+        void operator<<(F &&f) {
+            {
+                std::lock_guard lock(mutex);
+                if (terminated)
+                    return;
+                tasks.emplace_back(std::forward<F>(f));
+                ++pending;
+            }
+            cv_tasks.notify_one();
+        }
+
+        template <typename F>
+            requires std::invocable<F, T>
+        void operator>>(F &&f) {
+            std::unique_lock lock(mutex);
+            cv_results.wait(lock, [this]() { return !results.empty(); });
+            T res = std::move(results.front());
+            results.pop_front();
+            --pending;
+            lock.unlock();
+
+            f(std::move(res));
+        }
+
+        bool empty() const {
+            std::lock_guard lock(mutex);
+            return pending == 0;
+        }
+
+        /// drop the tasks that have not started yet, running ones still deliver their results
+        void terminate() {
+            std::lock_guard lock(mutex);
+            terminated = true;
+            pending -= tasks.size();
+            tasks.clear();
+        }
+
+    protected:
+        void work(std::stop_token st) {
+            for (;;) {
+                std::function<T()> task;
+                {
+                    std::unique_lock lock(mutex);
+                    cv_tasks.wait(lock, [&]() { return st.stop_requested() || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+
+                T res = task();
+                {
+                    std::lock_guard lock(mutex);
+                    results.push_back(std::move(res));
+                }
+                cv_results.notify_one();
+            }
+        }
+
+        mutable std::mutex mutex;
+        std::condition_variable cv_tasks, cv_results;
+        std::deque<std::function<T()>> tasks;
+        std::deque<T> results;
+        size_t pending = 0;
+        bool terminated = false;
+        std::vector<std::jthread> workers; // last member, so the threads are joined before anything else is destroyed
+    };
+} // namespace cppxx::multithreading
+
+#endif
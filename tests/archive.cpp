@@ -0,0 +1,194 @@
+#include "archive.h"
+#include <fmt/format.h>
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+
+namespace {
+    // a tar of pkg/src/lorem.txt and pkg/small.txt (GNU format), compressed with gzip into dynamic Huffman blocks
+    constexpr char tgz[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\xed\xd6\x41\x52\x83\x40\x10\x85\xe1\x59\x7b\x8a\x3e\x41\x32\x3d\x3d\x12"
+    "\xf5\x36\x18\x31\xc1\x0c\x01\x07\x30\xd1\xd3\x8b\x58\x6e\xb2\xd2\x57\x9a\x2a\xf5\x7d\x1b\x28\xa8\x5e\xf1\x03\xdd"
+    "\xed\x36\xcb\x3e\xaf\x97\xa9\xcd\x55\xb3\x18\x8e\x83\xfb\x7e\x7e\x52\xc4\x38\x1f\x27\xa7\xc7\xe8\x57\xc5\xc7\xf9"
+    "\xfb\x75\x55\x8d\xe6\xc4\xbb\x33\x18\xfb\xa1\xcc\x22\xee\x9f\x4a\xf5\xbe\x12\x7f\x23\xc3\xb6\x92\xc7\xb1\x5e\xef"
+    "\xe4\x36\xb7\x87\xbd\xdc\xb7\x47\x79\x18\x9b\xae\x97\xf6\xa9\xca\xf3\xed\x54\xbe\x3c\xcb\x5d\xbb\xb9\x98\x67\x14"
+    "\x98\x09\xc0\x8c\x01\x33\x11\x98\xb9\x04\x66\x0a\x60\x66\x05\xcc\x5c\x01\x33\xd7\xc8\x33\x85\x42\x40\x4a\x50\x24"
+    "\x05\x45\x5a\x50\x24\x06\x45\x6a\x50\x24\x07\x45\x7a\x50\x24\x08\x45\x8a\x08\x48\x11\x01\xfa\x36\x20\x45\x04\xa4"
+    "\x88\x80\x14\x11\x90\x22\x02\x52\x44\x40\x8a\x08\x48\x11\x01\x29\xc2\x90\x22\x0c\x29\xc2\xa0\xdf\x05\x52\x84\x21"
+    "\x45\x18\x52\x84\x21\x45\x18\x52\x84\x21\x45\xd8\x17\x8b\x70\xf4\xcb\x75\x6f\xfb\x7f\x53\xa6\xf4\x43\xbb\xff\x27"
+    "\xf6\xff\x89\x9d\xec\xff\xde\xcc\x73\xff\x3f\x87\x6d\xcd\x97\x98\x88\x88\x88\x88\x88\x88\x88\x88\x88\x88\x88\xe8"
+    "\x2f\x79\x05\xd2\x4f\x48\xa5\x00\x28\x00\x00";
+
+    // pkg/stored.txt (stored), pkg/deflated.txt (dynamic Huffman), pkg/tiny.txt (fixed Huffman) and pkg/dir/
+    constexpr char zip[] =
+    "\x50\x4b\x03\x04\x14\x00\x00\x00\x00\x00\x00\x00\x21\x00\xe2\x9c\x53\xa5\x07\x00\x00\x00\x07\x00\x00\x00\x0e\x00"
+    "\x00\x00\x70\x6b\x67\x2f\x73\x74\x6f\x72\x65\x64\x2e\x74\x78\x74\x73\x74\x6f\x72\x65\x64\x0a\x50\x4b\x03\x04\x14"
+    "\x00\x00\x00\x08\x00\x00\x00\x21\x00\x64\x58\x7b\x18\xa1\x00\x00\x00\x3e\x08\x00\x00\x10\x00\x00\x00\x70\x6b\x67"
+    "\x2f\x64\x65\x66\x6c\x61\x74\x65\x64\x2e\x74\x78\x74\x9d\xd5\x5b\x16\xc1\x50\x0c\x46\xe1\x77\xa3\xc8\x10\xe4\x0f"
+    "\x2d\x66\xe3\x72\x68\x39\x7a\x68\xd5\x6d\xf4\x16\x33\xb0\x9f\xb3\xf6\x53\xbe\x95\xe4\xb6\x4b\x36\x5d\xd9\xad\x49"
+    "\x76\x1d\xdb\xed\xc9\x36\x7d\x79\x74\xb6\x2f\x4f\x3b\x8e\xe7\xcb\x60\xe5\x9e\xfa\xdf\x38\xaf\xdf\x2f\xdb\x95\xc3"
+    "\x24\x7f\x1b\x07\x8d\x40\x13\xa0\x99\x81\x66\x0e\x9a\x0a\x34\x35\x68\x16\xa0\x59\x92\x9d\x22\x08\x44\x82\x13\x0a"
+    "\x4e\x2c\x38\xc1\xe0\x44\x83\x13\x0e\x4e\x3c\x38\x01\xe1\x44\x84\x88\x08\xa1\xdb\x40\x44\x88\x88\x10\x11\x21\x22"
+    "\x42\x44\x84\x88\x08\x11\x11\x22\x22\x82\x88\x08\x22\x22\xd0\xbb\x20\x22\x82\x88\x08\x22\x22\x88\x88\x20\x22\x82"
+    "\x88\x88\x3f\x45\x7c\x00\x50\x4b\x03\x04\x14\x00\x00\x00\x08\x00\x00\x00\x21\x00\xa5\x6a\x0a\x44\x0b\x00\x00\x00"
+    "\x0c\x00\x00\x00\x0c\x00\x00\x00\x70\x6b\x67\x2f\x74\x69\x6e\x79\x2e\x74\x78\x74\xcb\x48\xcd\xc9\xc9\x57\xc8\x00"
+    "\x91\x5c\x00\x50\x4b\x03\x04\x14\x00\x00\x00\x00\x00\x00\x00\x21\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x08\x00\x00\x00\x70\x6b\x67\x2f\x64\x69\x72\x2f\x50\x4b\x01\x02\x14\x03\x14\x00\x00\x00\x00\x00\x00\x00\x21"
+    "\x00\xe2\x9c\x53\xa5\x07\x00\x00\x00\x07\x00\x00\x00\x0e\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xa4\x01\x00"
+    "\x00\x00\x00\x70\x6b\x67\x2f\x73\x74\x6f\x72\x65\x64\x2e\x74\x78\x74\x50\x4b\x01\x02\x14\x03\x14\x00\x00\x00\x08"
+    "\x00\x00\x00\x21\x00\x64\x58\x7b\x18\xa1\x00\x00\x00\x3e\x08\x00\x00\x10\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\xa4\x01\x33\x00\x00\x00\x70\x6b\x67\x2f\x64\x65\x66\x6c\x61\x74\x65\x64\x2e\x74\x78\x74\x50\x4b\x01\x02\x14"
+    "\x03\x14\x00\x00\x00\x08\x00\x00\x00\x21\x00\xa5\x6a\x0a\x44\x0b\x00\x00\x00\x0c\x00\x00\x00\x0c\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\xa4\x01\x02\x01\x00\x00\x70\x6b\x67\x2f\x74\x69\x6e\x79\x2e\x74\x78\x74\x50\x4b\x01"
+    "\x02\x14\x03\x14\x00\x00\x00\x00\x00\x00\x00\x21\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x08\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x10\x00\xed\x41\x37\x01\x00\x00\x70\x6b\x67\x2f\x64\x69\x72\x2f\x50\x4b\x05\x06\x00"
+    "\x00\x00\x00\x04\x00\x04\x00\xea\x00\x00\x00\x5d\x01\x00\x00\x00\x00";
+
+    std::string lorem() {
+        std::string content;
+        for (int i = 0; i < 40; ++i)
+            content += fmt::format("line {}: the quick brown fox jumps over the lazy dog\n", i);
+        return content;
+    }
+
+    std::string octal(uint64_t value, size_t width) { return fmt::format("{:0{}o}", value, width - 1); }
+
+    // a ustar header and its padded data
+    std::string tar_entry(const std::string &name, char type, const std::string &data = "", const std::string &link = "") {
+        std::string h(512, '\0');
+        h.replace(0, std::min<size_t>(name.size(), 100), name.substr(0, 100));
+        h.replace(100, 7, octal(0644, 8));
+        h.replace(108, 7, octal(0, 8));
+        h.replace(116, 7, octal(0, 8));
+        h.replace(124, 11, octal(data.size(), 12));
+        h.replace(136, 11, octal(0, 12));
+        h[156] = type;
+        h.replace(157, link.size(), link);
+        h.replace(257, 6, std::string("ustar\0", 6));
+        h.replace(263, 2, "00");
+
+        uint64_t sum = 0;
+        for (size_t i = 0; i < 512; ++i)
+            sum += i >= 148 and i < 156 ? ' ' : uint8_t(h[i]);
+        h.replace(148, 7, octal(sum, 8));
+
+        return h + data + std::string((512 - data.size() % 512) % 512, '\0');
+    }
+
+    std::string tar_end() { return std::string(1024, '\0'); }
+
+    // a pax extended header of `records` for the entry that follows
+    std::string pax(const std::string &key, const std::string &value) {
+        std::string record = fmt::format(" {}={}\n", key, value);
+        size_t len = record.size() + 1;
+        while (std::to_string(len).size() + record.size() != len)
+            ++len;
+        return tar_entry("PaxHeaders/x", 'x', std::to_string(len) + record);
+    }
+} // namespace
+
+// a scratch directory for the archive and what is extracted from it, removed again at the end of each test
+class archive : public ::testing::Test {
+protected:
+    void SetUp() override {
+        root = fs::temp_directory_path() / ("cppxx-archive-" + std::to_string(::getpid()));
+        fs::create_directories(root);
+    }
+
+    void TearDown() override { fs::remove_all(root); }
+
+    std::expected<void, std::runtime_error> extract(const std::string &content, const std::string &name = "a.tar") {
+        std::ofstream(root / name, std::ios::binary) << content;
+        return extract_archive((root / name).string(), (root / "out").string());
+    }
+
+    std::string read(const std::string &path) {
+        std::ifstream is(root / "out" / path, std::ios::binary);
+        std::stringstream ss;
+        ss << is.rdbuf();
+        return ss.str();
+    }
+
+    fs::path root;
+};
+
+TEST_F(archive, crc32) {
+    EXPECT_EQ(crc32("123456789"), 0xcbf43926u);
+    EXPECT_EQ(crc32("6789", crc32("12345")), 0xcbf43926u);
+}
+
+TEST_F(archive, tgz) {
+    ASSERT_TRUE(extract(std::string(tgz, sizeof(tgz) - 1), "a.tgz").has_value());
+    EXPECT_EQ(read("pkg/src/lorem.txt"), lorem());
+    EXPECT_EQ(read("pkg/small.txt"), "hi\n");
+}
+
+TEST_F(archive, corrupted_tgz) {
+    std::string data(tgz, sizeof(tgz) - 1);
+    data[data.size() - 6] ^= 0x55; // the crc of the trailer
+    EXPECT_FALSE(extract(data, "a.tgz").has_value());
+}
+
+TEST_F(archive, zip) {
+    ASSERT_TRUE(extract(std::string(zip, sizeof(zip) - 1), "a.zip").has_value());
+    EXPECT_EQ(read("pkg/stored.txt"), "stored\n");
+    EXPECT_EQ(read("pkg/deflated.txt"), lorem());
+    EXPECT_EQ(read("pkg/tiny.txt"), "hello hello\n");
+    EXPECT_TRUE(fs::is_directory(root / "out" / "pkg/dir"));
+}
+
+TEST_F(archive, tar) {
+    const std::string prefix = "pkg/";
+    ASSERT_TRUE(extract(tar_entry(prefix, '5') + tar_entry(prefix + "a.txt", '0', "a\n") + tar_end()).has_value());
+    EXPECT_EQ(read("pkg/a.txt"), "a\n");
+}
+
+TEST_F(archive, long_names) {
+    const std::string gnu = "pkg/" + std::string(150, 'g') + ".txt", posix = "pkg/" + std::string(150, 'p') + ".txt";
+    const std::string data = tar_entry("././@LongLink", 'L', gnu + '\0') + tar_entry(gnu.substr(0, 100), '0', "gnu\n")
+        + pax("path", posix) + tar_entry(posix.substr(0, 100), '0', "pax\n") + tar_end();
+    ASSERT_TRUE(extract(data).has_value());
+    EXPECT_EQ(read(gnu), "gnu\n");
+    EXPECT_EQ(read(posix), "pax\n");
+}
+
+TEST_F(archive, links) {
+    const std::string data = tar_entry("pkg/a.txt", '0', "a\n") + tar_entry("pkg/hard.txt", '1', "", "pkg/a.txt")
+        + tar_entry("pkg/soft.txt", '2', "", "a.txt") + tar_end();
+    ASSERT_TRUE(extract(data).has_value());
+    EXPECT_EQ(read("pkg/hard.txt"), "a\n");
+    EXPECT_TRUE(fs::is_symlink(root / "out" / "pkg/soft.txt"));
+    EXPECT_EQ(read("pkg/soft.txt"), "a\n");
+}
+
+TEST_F(archive, outside_of_destination) {
+    EXPECT_FALSE(extract(tar_entry("../evil.txt", '0', "x") + tar_end()).has_value());
+    EXPECT_FALSE(fs::exists(root / "evil.txt"));
+
+    EXPECT_FALSE(extract(tar_entry("pkg/../../evil.txt", '0', "x") + tar_end()).has_value());
+    EXPECT_FALSE(fs::exists(root / "evil.txt"));
+
+    const std::string absolute = (root / "absolute.txt").string();
+    EXPECT_FALSE(extract(tar_entry(absolute, '0', "x") + tar_end()).has_value());
+    EXPECT_FALSE(fs::exists(absolute));
+
+    EXPECT_FALSE(extract(tar_entry("pkg/hard.txt", '1', "", "../../etc/passwd") + tar_end()).has_value());
+}
+
+TEST_F(archive, through_symlink) {
+    fs::create_directories(root / "elsewhere");
+    const std::string data = tar_entry("pkg/link", '2', "", (root / "elsewhere").string())
+        + tar_entry("pkg/link/evil.txt", '0', "x") + tar_end();
+    EXPECT_FALSE(extract(data).has_value());
+    EXPECT_FALSE(fs::exists(root / "elsewhere" / "evil.txt"));
+}
+
+TEST_F(archive, truncated) {
+    const std::string data = tar_entry("pkg/a.txt", '0', std::string(1000, 'a'));
+    EXPECT_FALSE(extract(data.substr(0, 800)).has_value());
+}
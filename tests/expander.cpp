@@ -0,0 +1,56 @@
+#include "expander.h"
+#include <gtest/gtest.h>
+#include <cstdlib>
+
+
+TEST(expander, vars) {
+    const std::unordered_map<std::string, std::string> vars = {{"a", "1"}, {"b", "${a}2"}, {"c", "${b}3"}};
+    Expander e(vars);
+    EXPECT_EQ(e.expand("${c}"), "123");
+    EXPECT_EQ(e.expand("x${a}y${b}z"), "x1y12z");
+    EXPECT_EQ(e.expand("no vars"), "no vars");
+    EXPECT_EQ(e.resolve_all(), (std::unordered_map<std::string, std::string>{{"a", "1"}, {"b", "12"}, {"c", "123"}}));
+}
+
+TEST(expander, defaults) {
+    const std::unordered_map<std::string, std::string> vars = {{"a", "1"}};
+    Expander e(vars);
+    EXPECT_EQ(e.expand("${a:-x}"), "1");
+    EXPECT_EQ(e.expand("${CPPXX_TEST_UNSET:-x}"), "x");
+    EXPECT_EQ(e.expand("${CPPXX_TEST_UNSET:-}"), "");
+    EXPECT_EQ(e.expand("${CPPXX_TEST_UNSET:-${a}/lib}"), "1/lib"); // defaults may reference vars
+    EXPECT_EQ(e.expand("${CPPXX_TEST_UNSET:-${CPPXX_TEST_UNSET:-y}}"), "y");
+    EXPECT_THROW(e.expand("${CPPXX_TEST_UNSET}"), std::runtime_error);
+}
+
+TEST(expander, environment) {
+    ::setenv("CPPXX_TEST_ENV", "env", 1);
+    const std::unordered_map<std::string, std::string> vars = {{"a", "${CPPXX_TEST_ENV}"}};
+    Expander e(vars);
+    EXPECT_EQ(e.expand("${a}"), "env");
+    EXPECT_EQ(e.expand("${CPPXX_TEST_ENV:-x}"), "env");
+    ::unsetenv("CPPXX_TEST_ENV");
+}
+
+TEST(expander, cycles) {
+    const std::unordered_map<std::string, std::string> vars = {{"a", "${b}"}, {"b", "${c}"}, {"c", "${a}"}};
+    Expander e(vars);
+    EXPECT_THROW(e.expand("${a}"), std::runtime_error);
+}
+
+TEST(expander, self_reference) {
+    // a var referencing its own name extends the environment variable
+    ::setenv("CPPXX_TEST_PATH", "/bin", 1);
+    const std::unordered_map<std::string, std::string> vars = {{"CPPXX_TEST_PATH", "${CPPXX_TEST_PATH}:/opt/bin"}};
+    Expander e(vars);
+    EXPECT_EQ(e.expand("${CPPXX_TEST_PATH}"), "/bin:/opt/bin");
+    ::unsetenv("CPPXX_TEST_PATH");
+}
+
+TEST(expander, malformed) {
+    const std::unordered_map<std::string, std::string> vars = {{"a", "1"}};
+    Expander e(vars);
+    EXPECT_THROW(e.expand("${a"), std::runtime_error);
+    EXPECT_THROW(e.expand("${}"), std::runtime_error);
+    EXPECT_THROW(e.expand("${1a}"), std::runtime_error);
+}
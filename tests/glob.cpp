@@ -0,0 +1,93 @@
+#include "glob.h"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+
+// a scratch directory tree, removed again at the end of each test
+class glob : public ::testing::Test {
+protected:
+    void SetUp() override {
+        root = fs::temp_directory_path() / ("cppxx-glob-" + std::to_string(::getpid()));
+        for (auto file : {"src/main.cpp", "src/util.cpp", "src/util.h", "src/.hidden.cpp", "src/a/x.cpp", "src/a/b/y.cpp",
+                          "src/a/b/y.c", "test/t1.cpp", "test/t2.cpp", "test/tx.cpp"}) {
+            fs::create_directories((root / file).parent_path());
+            std::ofstream(root / file) << "\n";
+        }
+    }
+
+    void TearDown() override { fs::remove_all(root); }
+
+    std::vector<std::string> expand(const std::string &pattern) {
+        std::vector<std::string> result;
+        for (auto &path : Glob().expand((root / pattern).string()))
+            result.push_back(fs::path(path).lexically_relative(root).string());
+        return result;
+    }
+
+    fs::path root;
+};
+
+TEST_F(glob, match) {
+    EXPECT_TRUE(Glob::match("*.cpp", "main.cpp"));
+    EXPECT_FALSE(Glob::match("*.cpp", "main.c"));
+    EXPECT_TRUE(Glob::match("t?.cpp", "t1.cpp"));
+    EXPECT_FALSE(Glob::match("t?.cpp", "t10.cpp"));
+    EXPECT_TRUE(Glob::match("*a*b*", "xaybz"));
+    EXPECT_FALSE(Glob::match("*a*b*", "xbya"));
+}
+
+TEST_F(glob, classes) {
+    EXPECT_TRUE(Glob::match("t[0-9].cpp", "t1.cpp"));
+    EXPECT_FALSE(Glob::match("t[0-9].cpp", "tx.cpp"));
+    EXPECT_TRUE(Glob::match("t[!0-9].cpp", "tx.cpp"));
+    EXPECT_FALSE(Glob::match("t[^0-9].cpp", "t1.cpp"));
+    EXPECT_TRUE(Glob::match("[]]", "]"));
+    EXPECT_TRUE(Glob::match("a[b", "a[b")); // not a class without the closing bracket
+    EXPECT_TRUE(Glob::match("\\*", "*"));
+    EXPECT_FALSE(Glob::match("\\*", "x"));
+}
+
+TEST_F(glob, braces) {
+    EXPECT_EQ(Glob::expand_braces("a.{c,cpp}"), (std::vector<std::string>{"a.c", "a.cpp"}));
+    EXPECT_EQ(Glob::expand_braces("{a,b{1,2}}.h"), (std::vector<std::string>{"a.h", "b1.h", "b2.h"}));
+    EXPECT_EQ(Glob::expand_braces("{a}.h"), (std::vector<std::string>{"{a}.h"}));
+    EXPECT_EQ(expand("src/{main,util}.cpp"), (std::vector<std::string>{"src/main.cpp", "src/util.cpp"}));
+}
+
+TEST_F(glob, segments) {
+    EXPECT_EQ(expand("src/*.cpp"), (std::vector<std::string>{"src/main.cpp", "src/util.cpp"}));
+    EXPECT_EQ(expand("src/.*.cpp"), (std::vector<std::string>{"src/.hidden.cpp"}));
+    EXPECT_EQ(expand("*/t[0-9].cpp"), (std::vector<std::string>{"test/t1.cpp", "test/t2.cpp"}));
+}
+
+TEST_F(glob, recursive) {
+    EXPECT_EQ(expand("src/**/*.cpp"), (std::vector<std::string>{"src/main.cpp", "src/util.cpp", "src/a/x.cpp", "src/a/b/y.cpp"}));
+    EXPECT_EQ(expand("src/**.cpp"), expand("src/**/*.cpp"));
+    EXPECT_EQ(expand("src/**/b/*"), (std::vector<std::string>{"src/a/b/y.c", "src/a/b/y.cpp"}));
+}
+
+TEST_F(glob, negation) {
+    Glob g;
+    auto res = g.expand(std::vector<std::string>{(root / "test/*.cpp").string(), '!' + (root / "test/tx.cpp").string()});
+    ASSERT_TRUE(res.has_value());
+    EXPECT_EQ(*res, (std::vector<std::string>{(root / "test/t1.cpp").string(), (root / "test/t2.cpp").string()}));
+
+    // only what comes before is excluded
+    res = g.expand(std::vector<std::string>{'!' + (root / "test/tx.cpp").string(), (root / "test/tx.cpp").string()});
+    ASSERT_TRUE(res.has_value());
+    EXPECT_EQ(*res, (std::vector<std::string>{(root / "test/tx.cpp").string()}));
+}
+
+TEST_F(glob, missing_directory) {
+    Glob g;
+    auto res = g.expand(std::vector<std::string>{(root / "src/*.cc").string()});
+    ASSERT_TRUE(res.has_value()); // no match in an existing directory is fine
+    EXPECT_TRUE(res->empty());
+
+    EXPECT_FALSE(g.expand(std::vector<std::string>{(root / "srcs/*.cpp").string()}).has_value());
+    EXPECT_TRUE(g.expand(std::vector<std::string>{(root / "{srcs,src}/*.cpp").string()}).has_value());
+}
@@ -0,0 +1,38 @@
+#include <cppxx/multithreading/pool.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <set>
+
+using namespace cppxx::multithreading;
+
+TEST(pool, results) {
+    Pool<int> pool(4);
+    for (int i = 0; i < 100; ++i)
+        pool << [i]() { return i; };
+
+    std::set<int> received;
+    while (not pool.empty())
+        pool >> [&](int i) { received.insert(i); };
+
+    EXPECT_EQ(received.size(), 100);
+    EXPECT_EQ(*received.begin(), 0);
+    EXPECT_EQ(*received.rbegin(), 99);
+}
+
+TEST(pool, bounded) {
+    std::atomic_int running = 0, peak = 0;
+    Pool<bool> pool(2);
+    for (int i = 0; i < 16; ++i)
+        pool << [&]() {
+            int now = ++running;
+            for (int p = peak; now > p && !peak.compare_exchange_weak(p, now);) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --running;
+            return true;
+        };
+
+    while (not pool.empty())
+        pool >> [](bool) {};
+
+    EXPECT_LE(peak, 2);
+}